@@ -835,6 +835,391 @@ MainProgram::CmdResult MainProgram::cmd_clear_fibres(std::ostream& output, MainP
     return {};
 }
 
+MainProgram::CmdResult MainProgram::cmd_route_engine(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string engine = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    // Report how much the previous engine did before switching
+    output << "Nodes settled by route_fastest: " << ds_.settled_count() << endl;
+    ds_.reset_settled_count();
+
+    if (engine == "dijkstra") { ds_.set_route_engine(Datastructures::Route_engine::DIJKSTRA); }
+    else if (engine == "bidirectional") { ds_.set_route_engine(Datastructures::Route_engine::BIDIRECTIONAL); }
+    else if (engine == "alt") { ds_.set_route_engine(Datastructures::Route_engine::ALT); }
+    else { ds_.set_route_engine(Datastructures::Route_engine::CH); }
+    output << "Route engine set to " << engine << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_cache_capacity(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string capacitystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    std::size_t capacity = convert_string_to<std::size_t>(capacitystr);
+    ds_.set_route_cache_capacity(capacity);
+    output << "Route cache capacity set to " << capacity << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_cache_stats(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    output << "Route cache hits: " << ds_.route_cache_hits() << ", misses: " << ds_.route_cache_misses() << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_path_tree_limit(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string bytesstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    std::size_t bytes = convert_string_to<std::size_t>(bytesstr);
+    ds_.set_path_tree_memory_limit(bytes);
+    output << "Path tree memory limit set to " << bytes << " bytes" << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_same_component(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string x1str = *begin++;
+    string y1str = *begin++;
+    string x2str = *begin++;
+    string y2str = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    Coord xy1 = {convert_string_to<int>(x1str), convert_string_to<int>(y1str)};
+    Coord xy2 = {convert_string_to<int>(x2str), convert_string_to<int>(y2str)};
+
+    bool same = ds_.same_component(xy1, xy2);
+    print_coord(xy1, output, false);
+    output << " and ";
+    print_coord(xy2, output, false);
+    output << (same ? " are connected" : " are not connected") << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_shortest_cycle(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string fromxstr = *begin++;
+    string fromystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int fromx = convert_string_to<int>(fromxstr);
+    int fromy = convert_string_to<int>(fromystr);
+
+    auto result = ds_.route_shortest_cycle({fromx, fromy});
+
+    if (result.empty())
+    {
+        output << "No fibre cycles found." << endl;
+    }
+
+    return {ResultType::PATH, result};
+}
+
+MainProgram::CmdResult MainProgram::cmd_girth(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto result = ds_.girth();
+    if (result == NO_COST)
+    {
+        output << "No fibre cycles found." << endl;
+    }
+    else
+    {
+        output << "Girth: " << result << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_minimum_spanning_backbone(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto [fibres, total] = ds_.minimum_spanning_backbone();
+    if (fibres.empty())
+    {
+        output << "No fibres!" << endl;
+    }
+    else
+    {
+        for (auto& [xy1, xy2] : fibres)
+        {
+            output << "(" << xy1.x << "," << xy1.y << ") -> (" << xy2.x << "," << xy2.y << ")" << endl;
+        }
+        output << "Total cost: " << total << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_k_fastest(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string fromxstr = *begin++;
+    string fromystr = *begin++;
+    string toxstr = *begin++;
+    string toystr = *begin++;
+    string kstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int fromx = convert_string_to<int>(fromxstr);
+    int fromy = convert_string_to<int>(fromystr);
+    int tox = convert_string_to<int>(toxstr);
+    int toy = convert_string_to<int>(toystr);
+    unsigned int k = convert_string_to<unsigned int>(kstr);
+
+    auto routes = ds_.route_k_fastest({fromx, fromy}, {tox, toy}, k);
+    if (routes.empty())
+    {
+        output << "No path found!" << endl;
+    }
+
+    unsigned int route_num = 1;
+    for (auto& route : routes)
+    {
+        output << "Route " << route_num << ":" << endl;
+        unsigned int num = 1;
+        for (auto& [coord, cost] : route)
+        {
+            output << num << ". ";
+            if (num > 1) { output << "-> "; }
+            else { output << "   "; }
+            print_coord(coord, output, false);
+            output << " : " << cost << endl;
+            ++num;
+        }
+        ++route_num;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_nearest_xpoint(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+
+    auto result = ds_.nearest_xpoint({x, y});
+    if (result == NO_COORD)
+    {
+        output << "No xpoints!" << endl;
+        return {};
+    }
+
+    return {ResultType::COORDLIST, CmdResultCoords{result}};
+}
+
+MainProgram::CmdResult MainProgram::cmd_xpoints_in_rect(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string minxstr = *begin++;
+    string minystr = *begin++;
+    string maxxstr = *begin++;
+    string maxystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int minx = convert_string_to<int>(minxstr);
+    int miny = convert_string_to<int>(minystr);
+    int maxx = convert_string_to<int>(maxxstr);
+    int maxy = convert_string_to<int>(maxystr);
+
+    auto result = ds_.xpoints_in_rect({minx, miny}, {maxx, maxy});
+    if (result.empty())
+    {
+        output << "No xpoints!" << endl;
+    }
+
+    return {ResultType::COORDLIST, result};
+}
+
+MainProgram::CmdResult MainProgram::cmd_xpoints_within_radius(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    string radiusstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+    int radius = convert_string_to<int>(radiusstr);
+
+    auto result = ds_.xpoints_within_radius({x, y}, radius);
+    if (result.empty())
+    {
+        output << "No xpoints!" << endl;
+    }
+
+    return {ResultType::COORDLIST, result};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_costs(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    string tosstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+    auto toxpoints = parse_coords(tosstr);
+
+    auto result = ds_.route_costs({x, y}, toxpoints);
+    for (std::size_t i = 0; i < result.size(); ++i)
+    {
+        output << i+1 << ". ";
+        print_coord(toxpoints[i], output, false);
+        if (result[i] == NO_COST) { output << " : No path" << endl; }
+        else { output << " : " << result[i] << endl; }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_cost_matrix(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string fromsstr = *begin++;
+    string tosstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    auto fromxpoints = parse_coords(fromsstr);
+    auto toxpoints = parse_coords(tosstr);
+
+    auto result = ds_.route_cost_matrix(fromxpoints, toxpoints);
+    for (std::size_t i = 0; i < result.size(); ++i)
+    {
+        output << "From ";
+        print_coord(fromxpoints[i], output, false);
+        output << ":" << endl;
+        for (std::size_t j = 0; j < result[i].size(); ++j)
+        {
+            output << j+1 << ". ";
+            print_coord(toxpoints[j], output, false);
+            if (result[i][j] == NO_COST) { output << " : No path" << endl; }
+            else { output << " : " << result[i][j] << endl; }
+        }
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_costs_all(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+
+    auto result = ds_.route_costs_all({x, y});
+    if (result.empty())
+    {
+        output << "No xpoints!" << endl;
+    }
+
+    unsigned int num = 1;
+    for (auto& [coord, cost] : result)
+    {
+        output << num << ". ";
+        print_coord(coord, output, false);
+        if (cost == NO_COST) { output << " : No path" << endl; }
+        else { output << " : " << cost << endl; }
+        ++num;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_route_cost(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string fromxstr = *begin++;
+    string fromystr = *begin++;
+    string toxstr = *begin++;
+    string toystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int fromx = convert_string_to<int>(fromxstr);
+    int fromy = convert_string_to<int>(fromystr);
+    int tox = convert_string_to<int>(toxstr);
+    int toy = convert_string_to<int>(toystr);
+
+    auto result = ds_.route_cost({fromx, fromy}, {tox, toy});
+    if (result == NO_COST)
+    {
+        output << "No path found!" << endl;
+    }
+    else
+    {
+        output << "Cost: " << result << endl;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_hub_label_memory(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    assert( begin == end && "Impossible number of parameters!");
+
+    output << "Hub labels: " << ds_.hub_label_memory() << " bytes" << endl;
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_xpoints_within_cost(std::ostream& output, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    string budgetstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+    Cost budget = convert_string_to<Cost>(budgetstr);
+
+    auto result = ds_.xpoints_within_cost({x, y}, budget);
+    if (result.empty())
+    {
+        output << "No xpoints!" << endl;
+    }
+
+    unsigned int num = 1;
+    for (auto& [coord, cost] : result)
+    {
+        output << num << ". ";
+        print_coord(coord, output, false);
+        output << " : " << cost << endl;
+        ++num;
+    }
+
+    return {};
+}
+
+MainProgram::CmdResult MainProgram::cmd_nearest_beacon_by_fibre(std::ostream& /*output*/, MainProgram::MatchIter begin, MainProgram::MatchIter end)
+{
+    string xstr = *begin++;
+    string ystr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    int x = convert_string_to<int>(xstr);
+    int y = convert_string_to<int>(ystr);
+
+    auto result = ds_.nearest_beacon_by_fibre({x, y});
+    return {ResultType::IDLIST, MainProgram::CmdResultIDs{result}};
+}
+
 MainProgram::CmdResult MainProgram::cmd_randseed(std::ostream& output, MatchIter begin, MatchIter end)
 {
     string seedstr = *begin++;
@@ -1081,6 +1466,17 @@ string const wsx = "[[:space:]]+";
 string const namex = "([ a-zA-Z0-9-]+)";
 string const cmdx = "[0-9a-zA-Z_#]+";
 
+std::vector<Coord> MainProgram::parse_coords(std::string const& coordsstr)
+{
+    static std::regex const coordre(coordx);
+    std::vector<Coord> coords;
+    for (std::sregex_iterator it(coordsstr.begin(), coordsstr.end(), coordre); it != std::sregex_iterator(); ++it)
+    {
+        coords.push_back({convert_string_to<int>((*it)[1]), convert_string_to<int>((*it)[2])});
+    }
+    return coords;
+}
+
 vector<MainProgram::CmdInfo> MainProgram::cmds_ =
 {
     {"beacon_info", "ID", beaconidx, &MainProgram::cmd_beacon_info, &MainProgram::test_get_functions },
@@ -1113,6 +1509,30 @@ vector<MainProgram::CmdInfo> MainProgram::cmds_ =
     {"route_fastest", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_fastest, &MainProgram::test_route_fastest },
     {"route_least_xpoints", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_least_xpoints, &MainProgram::test_route_least_xpoints },
     {"route_fibre_cycle", "(x1,y1)", coordx, &MainProgram::cmd_route_fibre_cycle, &MainProgram::test_route_fibre_cycle },
+    {"same_component", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_same_component, nullptr },
+    {"route_shortest_cycle", "(x1,y1)", coordx, &MainProgram::cmd_route_shortest_cycle, nullptr },
+    {"girth", "", "", &MainProgram::cmd_girth, nullptr },
+    {"minimum_spanning_backbone", "", "", &MainProgram::cmd_minimum_spanning_backbone, nullptr },
+    {"route_k_fastest", "(x1,y1) (x2,y2) k", coordx+wsx+coordx+wsx+numx, &MainProgram::cmd_route_k_fastest, nullptr },
+    {"route_fastest_batch", "(x1,y1) (x2,y2) [(x3,y3) (x4,y4) ...] (parts in [] are optional)", "("+optcoordx+wsx+optcoordx+"(?:"+wsx+optcoordx+wsx+optcoordx+")*)",
+     &MainProgram::RouteBatchCmd<&Datastructures::route_fastest_batch>, nullptr },
+    {"route_least_xpoints_batch", "(x1,y1) (x2,y2) [(x3,y3) (x4,y4) ...] (parts in [] are optional)", "("+optcoordx+wsx+optcoordx+"(?:"+wsx+optcoordx+wsx+optcoordx+")*)",
+     &MainProgram::RouteBatchCmd<&Datastructures::route_least_xpoints_batch>, nullptr },
+    {"route_costs", "(x,y) (x1,y1) [(x2,y2) ...] (parts in [] are optional)", coordx+wsx+"("+optcoordx+"(?:"+wsx+optcoordx+")*)", &MainProgram::cmd_route_costs, nullptr },
+    {"route_cost_matrix", "(x1,y1) [(x2,y2) ...] ; (x3,y3) [(x4,y4) ...] (parts in [] are optional)",
+     "("+optcoordx+"(?:"+wsx+optcoordx+")*)"+"[[:space:]]*;[[:space:]]*"+"("+optcoordx+"(?:"+wsx+optcoordx+")*)", &MainProgram::cmd_route_cost_matrix, nullptr },
+    {"route_costs_all", "(x,y)", coordx, &MainProgram::cmd_route_costs_all, nullptr },
+    {"nearest_xpoint", "(x,y)", coordx, &MainProgram::cmd_nearest_xpoint, nullptr },
+    {"xpoints_in_rect", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_xpoints_in_rect, nullptr },
+    {"xpoints_within_radius", "(x,y) radius", coordx+wsx+numx, &MainProgram::cmd_xpoints_within_radius, nullptr },
+    {"route_cost", "(x1,y1) (x2,y2)", coordx+wsx+coordx, &MainProgram::cmd_route_cost, nullptr },
+    {"hub_label_memory", "", "", &MainProgram::cmd_hub_label_memory, nullptr },
+    {"xpoints_within_cost", "(x,y) budget", coordx+wsx+numx, &MainProgram::cmd_xpoints_within_cost, nullptr },
+    {"nearest_beacon_by_fibre", "(x,y)", coordx, &MainProgram::cmd_nearest_beacon_by_fibre, nullptr },
+    {"route_engine", "dijkstra|bidirectional|alt|ch (alternatives separated by |)", "(dijkstra|bidirectional|alt|ch)", &MainProgram::cmd_route_engine, nullptr },
+    {"route_cache_capacity", "capacity (0 turns the cache off)", numx, &MainProgram::cmd_route_cache_capacity, nullptr },
+    {"route_cache_stats", "", "", &MainProgram::cmd_route_cache_stats, nullptr },
+    {"path_tree_limit", "bytes (0 turns the path trees off)", numx, &MainProgram::cmd_path_tree_limit, nullptr },
     {"quit", "", "", nullptr, nullptr },
     {"help", "", "", &MainProgram::help_command, nullptr },
     {"read", "\"in-filename\" [silent]", "\"([-a-zA-Z0-9 ./:_]+)\"(?:"+wsx+"(silent))?", &MainProgram::cmd_read, nullptr },
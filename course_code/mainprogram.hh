@@ -27,6 +27,7 @@
 #include <vector>
 #include <array>
 #include <utility>
+#include <span>
 #include <variant>
 #include <bitset>
 #include <cassert>
@@ -145,6 +146,25 @@ private:
     CmdResult cmd_route_least_xpoints(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_route_fibre_cycle(std::ostream& output, MatchIter begin, MatchIter end);
     CmdResult cmd_clear_fibres(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_engine(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_cache_capacity(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_cache_stats(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_path_tree_limit(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_same_component(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_shortest_cycle(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_girth(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_minimum_spanning_backbone(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_k_fastest(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_costs(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_cost_matrix(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_costs_all(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_nearest_xpoint(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_xpoints_in_rect(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_xpoints_within_radius(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_route_cost(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_hub_label_memory(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_xpoints_within_cost(std::ostream& output, MatchIter begin, MatchIter end);
+    CmdResult cmd_nearest_beacon_by_fibre(std::ostream& output, MatchIter begin, MatchIter end);
     // CmdResult cmd_watchtest(std::ostream& output, MatchIter begin, MatchIter end);
 
     void test_get_functions(Stopwatch& watch);
@@ -172,6 +192,7 @@ private:
     void add_random_beacons(unsigned int size, Stopwatch* watchp, Coord min = {1,1}, Coord max = {10000, 10000});
     std::string print_beacon(BeaconID id, std::ostream& output);
     std::string print_coord(Coord coord, std::ostream& output, bool nl = true);
+    static std::vector<Coord> parse_coords(std::string const& coordsstr);
 
     template <typename Type>
     Type random(Type start, Type end);
@@ -180,18 +201,21 @@ private:
     template <typename From>
     static std::string convert_to_string(From from);
 
-    template<BeaconID(Datastructures::*MFUNC)()>
+    template<BeaconID(Datastructures::*MFUNC)() const>
     CmdResult NoParBeaconCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
-    template<std::vector<BeaconID>(Datastructures::*MFUNC)()>
+    template<std::vector<BeaconID>(Datastructures::*MFUNC)() const>
     CmdResult NoParBeaconListCmd(std::ostream& output, MatchIter begin, MatchIter end);
 
-    template<BeaconID(Datastructures::*MFUNC)()>
+    template<BeaconID(Datastructures::*MFUNC)() const>
     void NoParBeaconTestCmd(Stopwatch& watch);
 
-    template<std::vector<BeaconID>(Datastructures::*MFUNC)()>
+    template<std::vector<BeaconID>(Datastructures::*MFUNC)() const>
     void NoParListTestCmd(Stopwatch& watch);
 
+    template<std::vector<std::vector<std::pair<Coord, Cost>>>(Datastructures::*MFUNC)(std::span<const std::pair<Coord, Coord>>) const>
+    CmdResult RouteBatchCmd(std::ostream& output, MatchIter begin, MatchIter end);
+
     void create_fibre_labyrinth(std::ostream& output, int xsize, int ysize, int extrafibres);
 
     enum Dir {FIRSTDIR=0, WEST=0, EAST, NORTHWEST, NORTHEAST, SOUTHWEST, SOUTHEAST, ENDDIR};
@@ -401,21 +425,21 @@ std::string MainProgram::convert_to_string(From from)
     return ostr.str();
 }
 
-template<BeaconID(Datastructures::*MFUNC)()>
+template<BeaconID(Datastructures::*MFUNC)() const>
 MainProgram::CmdResult MainProgram::NoParBeaconCmd(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     auto result = (ds_.*MFUNC)();
     return {ResultType::IDLIST, MainProgram::CmdResultIDs{result}};
 }
 
-template<std::vector<BeaconID>(Datastructures::*MFUNC)()>
+template<std::vector<BeaconID>(Datastructures::*MFUNC)() const>
 MainProgram::CmdResult MainProgram::NoParBeaconListCmd(std::ostream& /*output*/, MatchIter /*begin*/, MatchIter /*end*/)
 {
     auto result = (ds_.*MFUNC)();
     return {ResultType::IDLIST, result};
 }
 
-template<BeaconID(Datastructures::*MFUNC)()>
+template<BeaconID(Datastructures::*MFUNC)() const>
 void MainProgram::NoParBeaconTestCmd(Stopwatch& watch)
 {
     watch.start();
@@ -423,7 +447,7 @@ void MainProgram::NoParBeaconTestCmd(Stopwatch& watch)
     watch.stop();
 }
 
-template<std::vector<BeaconID>(Datastructures::*MFUNC)()>
+template<std::vector<BeaconID>(Datastructures::*MFUNC)() const>
 void MainProgram::NoParListTestCmd(Stopwatch& watch)
 {
     watch.start();
@@ -431,5 +455,45 @@ void MainProgram::NoParListTestCmd(Stopwatch& watch)
     watch.stop();
 }
 
+template<std::vector<std::vector<std::pair<Coord, Cost>>>(Datastructures::*MFUNC)(std::span<const std::pair<Coord, Coord>>) const>
+MainProgram::CmdResult MainProgram::RouteBatchCmd(std::ostream& output, MatchIter begin, MatchIter end)
+{
+    std::string pairsstr = *begin++;
+    assert( begin == end && "Impossible number of parameters!");
+
+    // Coordinates come in (from) (to) pairs
+    auto coords = parse_coords(pairsstr);
+    std::vector<std::pair<Coord, Coord>> queries;
+    for (std::size_t i = 0; i+1 < coords.size(); i += 2)
+    {
+        queries.emplace_back(coords[i], coords[i+1]);
+    }
+
+    auto routes = (ds_.*MFUNC)(queries);
+    for (std::size_t i = 0; i < routes.size(); ++i)
+    {
+        output << "Route " << i+1 << ": ";
+        print_coord(queries[i].first, output, false);
+        output << " -> ";
+        print_coord(queries[i].second, output);
+        if (routes[i].empty())
+        {
+            output << "No path found!" << std::endl;
+        }
+        unsigned int num = 1;
+        for (auto& [coord, cost] : routes[i])
+        {
+            output << num << ". ";
+            if (num > 1) { output << "-> "; }
+            else { output << "   "; }
+            print_coord(coord, output, false);
+            output << " : " << cost << std::endl;
+            ++num;
+        }
+    }
+
+    return {};
+}
+
 
 #endif // MAINPROGRAM_HH
@@ -9,6 +9,12 @@
 #include <deque>
 #include <stack>
 #include <queue>
+#include <bit>
+#include <cmath>
+#include <limits>
+#include <thread>
+#include <atomic>
+#include <unordered_set>
 
 std::minstd_rand rand_engine; // Reasonably quick pseudo-random generator
 
@@ -23,6 +29,268 @@ Type random_in_range(Type start, Type end)
     return static_cast<Type>(start+num);
 }
 
+template <typename Search>
+void Datastructures::with_route_queue(Cost max_key_step, Search search) const
+{
+    if (min_fibre_cost_ < 0) {
+        Binary_heap Q;
+        search(Q);
+    }
+    else if (max_key_step <= MAX_BUCKET_QUEUE_COST) {
+        Bucket_queue Q(max_key_step);
+        search(Q);
+    }
+    else {
+        Radix_heap Q;
+        search(Q);
+    }
+}
+
+template <typename Queue, typename Settled>
+void Datastructures::dijkstra(Search_state& S, Queue& Q, int s, Settled settled) const
+{
+    S.touch(s);
+    S.color[s] = GRAY;
+    S.d[s] = 0;
+    Q.push(0, s);
+
+    while (!Q.empty()) {
+        auto [du, u] = Q.pop();
+        //Stale entry, u was pushed again with a smaller d or is done.
+        if (S.color[u] == BLACK || du != S.d[u]) {
+            continue;
+        }
+        S.color[u] = BLACK;
+        if (!settled(u)) {
+            return;
+        }
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            int v = fibre_table_[fibre].other(u);
+            Cost cost = fibre_table_[fibre].cost;
+            S.touch(v);
+            if (S.color[v] != BLACK && relax(S, u, v, cost)) {
+                S.color[v] = GRAY;
+                Q.push(S.d[v], v);
+            }
+        }
+    }
+}
+
+template <typename Queue>
+std::vector<std::pair<Coord, Cost>> Datastructures::bidirectional_dijkstra(Search_state& S, Queue& Q,
+                                                                           Search_state& Sb, Queue& Qb,
+                                                                           int s, int t) const
+{
+    S.touch(s);
+    S.color[s] = GRAY;
+    S.d[s] = 0;
+    Q.push(0, s);
+    Sb.touch(t);
+    Sb.color[t] = GRAY;
+    Sb.d[t] = 0;
+    Qb.push(0, t);
+
+    //Best route found so far is s -> meet_f, meet_f - meet_b, meet_b -> t.
+    Cost best = -1; //infinity
+    int meet_f = -1;
+    int meet_b = -1;
+    unsigned long long settled = 0;
+    if (s == t) {
+        best = 0;
+        meet_f = s;
+        meet_b = t;
+    }
+
+    while (!Q.empty() && !Qb.empty()) {
+        if (best != -1 && Q.min_key() + Qb.min_key() >= best) {
+            break;
+        }
+        //Expand the side whose frontier is closer.
+        bool forward = Q.min_key() <= Qb.min_key();
+        Search_state& A = forward ? S : Sb;
+        Search_state& B = forward ? Sb : S;
+        Queue& QA = forward ? Q : Qb;
+
+        auto [du, u] = QA.pop();
+        if (A.color[u] == BLACK || du != A.d[u]) {
+            continue;
+        }
+        A.color[u] = BLACK;
+        ++settled;
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            int v = fibre_table_[fibre].other(u);
+            Cost cost = fibre_table_[fibre].cost;
+            A.touch(v);
+            if (A.color[v] != BLACK && relax(A, u, v, cost)) {
+                A.color[v] = GRAY;
+                QA.push(A.d[v], v);
+            }
+            //Did the frontiers meet on this fibre?
+            B.touch(v);
+            if (B.d[v] != -1 && (best == -1 || A.d[u] + cost + B.d[v] < best)) {
+                best = A.d[u] + cost + B.d[v];
+                meet_f = forward ? u : v;
+                meet_b = forward ? v : u;
+            }
+        }
+    }
+
+    settled_count_ += settled;
+    if (best == -1) {
+        return {};
+    }
+    //Forward half from S, backward half by walking path_back of Sb.
+    std::vector<std::pair<Coord, Cost>> route = build_route(S, meet_f);
+    for (int v = meet_b; v != -1 && v != meet_f; v = Sb.path_back[v]) {
+        route.emplace_back(nodes_by_id_[v]->location, best - Sb.d[v]);
+    }
+    return route;
+}
+
+template <typename Queue>
+void Datastructures::alt_search(Search_state& S, Queue& Q, int s, int t) const
+{
+    unsigned long long settled = 0;
+    S.touch(s);
+    S.color[s] = GRAY;
+    S.d[s] = 0;
+    Q.push(landmark_bound(s, t), s);
+
+    while (!Q.empty()) {
+        auto [key, u] = Q.pop();
+        if (S.color[u] == BLACK || key != S.d[u] + landmark_bound(u, t)) {
+            continue;
+        }
+        S.color[u] = BLACK;
+        ++settled;
+        if (u == t) {
+            break;
+        }
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            int v = fibre_table_[fibre].other(u);
+            Cost cost = fibre_table_[fibre].cost;
+            S.touch(v);
+            if (S.color[v] != BLACK && relax(S, u, v, cost)) {
+                S.color[v] = GRAY;
+                Q.push(S.d[v] + landmark_bound(v, t), v);
+            }
+        }
+    }
+    settled_count_ += settled;
+}
+
+template <typename Keep>
+std::vector<Coord> Datastructures::Spatial_grid::in_rect(Coord min, Coord max, Keep keep) const
+{
+    std::vector<Coord> result = {};
+    if (max.x < min.x || max.y < min.y || size_ == 0) {
+        return result;
+    }
+    auto add = [&](const std::vector<Coord>& xpoints) {
+        for (Coord c : xpoints) {
+            if (min.x <= c.x && c.x <= max.x && min.y <= c.y && c.y <= max.y && keep(c)) {
+                result.push_back(c);
+            }
+        }
+    };
+    Coord first = cell_of(min);
+    Coord last = cell_of(max);
+    first = {std::max(first.x, min_cell_.x), std::max(first.y, min_cell_.y)};
+    last = {std::min(last.x, max_cell_.x), std::min(last.y, max_cell_.y)};
+    if (last.x < first.x || last.y < first.y) {
+        return result;
+    }
+    //A rectangle with more cells than there are non-empty cells is cheaper
+    //to answer by going through the non-empty ones.
+    long long cells = (static_cast<long long>(last.x) - first.x + 1) * (static_cast<long long>(last.y) - first.y + 1);
+    if (cells > static_cast<long long>(cells_.size())) {
+        for (const auto& [cell, xpoints] : cells_) {
+            add(xpoints);
+        }
+        return result;
+    }
+    for (long long y = first.y; y <= last.y; ++y) {
+        for (long long x = first.x; x <= last.x; ++x) {
+            auto it = cells_.find({static_cast<int>(x), static_cast<int>(y)});
+            if (it != cells_.end()) {
+                add(it->second);
+            }
+        }
+    }
+    return result;
+}
+
+template <typename Queue>
+void Datastructures::spur_search(Search_state& S, Queue& Q, int s, int t, const std::vector<Cost>& to_t,
+                                 const std::vector<char>& node_banned, const std::vector<char>& fibre_banned) const
+{
+    S.touch(s);
+    S.color[s] = GRAY;
+    S.d[s] = 0;
+    Q.push(to_t[s], s);
+
+    while (!Q.empty()) {
+        auto [key, u] = Q.pop();
+        if (S.color[u] == BLACK || key != S.d[u] + to_t[u]) {
+            continue;
+        }
+        S.color[u] = BLACK;
+        if (u == t) {
+            return;
+        }
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            int v = fibre_table_[fibre].other(u);
+            if (fibre_banned[fibre] || node_banned[v] || to_t[v] == -1) {
+                continue;
+            }
+            S.touch(v);
+            if (S.color[v] != BLACK && relax(S, u, v, fibre_table_[fibre].cost)) {
+                S.color[v] = GRAY;
+                Q.push(S.d[v] + to_t[v], v);
+            }
+        }
+    }
+}
+
+template <typename Make_worker>
+void Datastructures::parallel_for(std::size_t count, Make_worker make_worker) const
+{
+    std::atomic<std::size_t> next = 0;
+    auto run = [&]() {
+        auto worker = make_worker();
+        for (std::size_t i = next++; i < count; i = next++) {
+            worker(i);
+        }
+    };
+    std::size_t thread_count = std::max(1u, std::thread::hardware_concurrency());
+    thread_count = std::min(thread_count, count);
+    std::vector<std::thread> threads = {};
+    for (std::size_t i = 1; i < thread_count; ++i) {
+        threads.emplace_back(run);
+    }
+    run();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+thread_local Datastructures::Search_state Datastructures::search_;
+thread_local Datastructures::Search_state Datastructures::search_back_;
+
+std::shared_lock<std::shared_mutex> Datastructures::read_lock() const
+{
+    //A writer waiting for mutex_ holds write_turn_, so new queries wait
+    //behind it instead of keeping it out forever.
+    std::lock_guard turn(write_turn_);
+    return std::shared_lock(mutex_);
+}
+
+std::unique_lock<std::shared_mutex> Datastructures::write_lock()
+{
+    std::lock_guard turn(write_turn_);
+    return std::unique_lock(mutex_);
+}
+
 // Modify the code below to implement the functionality of the class.
 // Also remove comments from the parameter names when you implement
 // an operation (Commenting out parameter name prevents compiler from
@@ -42,6 +310,7 @@ Datastructures::~Datastructures()
 
 bool Datastructures::add_beacon(BeaconID id, const Name& name, Coord xy, Color color)
 {
+    auto lock = write_lock();
     //make a shared_ptr to the new Beacon object.
     std::shared_ptr<Beacon> beaconptr = std::make_shared<Beacon>(id, name, xy, color, color);
 
@@ -50,6 +319,7 @@ bool Datastructures::add_beacon(BeaconID id, const Name& name, Coord xy, Color c
         //maintain auxiliary data structures that help with getting
         //sorted data.
         name_map_.emplace(name, beaconptr);
+        beacons_at_[xy].insert(id);
         int brightness = 3 * color.r + 6 * color.g + color.b;
         brightness_map_.emplace(brightness, beaconptr);
         return true;
@@ -57,20 +327,24 @@ bool Datastructures::add_beacon(BeaconID id, const Name& name, Coord xy, Color c
     return false;
 }
 
-int Datastructures::beacon_count()
+int Datastructures::beacon_count() const
 {
+    auto lock = read_lock();
     return beacon_map_.size();
 }
 
 void Datastructures::clear_beacons()
 {
+    auto lock = write_lock();
     beacon_map_.clear();
     name_map_.clear();
     brightness_map_.clear();
+    beacons_at_.clear();
 }
 
-std::vector<BeaconID> Datastructures::all_beacons()
+std::vector<BeaconID> Datastructures::all_beacons() const
 {
+    auto lock = read_lock();
     //Initialize result vector
     std::vector<BeaconID> result = {};
 
@@ -81,8 +355,9 @@ std::vector<BeaconID> Datastructures::all_beacons()
     return result;
 }
 
-Name Datastructures::get_name(BeaconID id)
+Name Datastructures::get_name(BeaconID id) const
 {
+    auto lock = read_lock();
     if (beacon_map_.contains(id)) {
         return beacon_map_.at(id)->name;
     }
@@ -91,8 +366,9 @@ Name Datastructures::get_name(BeaconID id)
     }
 }
 
-Coord Datastructures::get_coordinates(BeaconID id)
+Coord Datastructures::get_coordinates(BeaconID id) const
 {
+    auto lock = read_lock();
     if (beacon_map_.contains(id)) {
         return beacon_map_.at(id)->xy;
     }
@@ -101,8 +377,9 @@ Coord Datastructures::get_coordinates(BeaconID id)
     }
 }
 
-Color Datastructures::get_color(BeaconID id)
+Color Datastructures::get_color(BeaconID id) const
 {
+    auto lock = read_lock();
     if (beacon_map_.contains(id)) {
         return beacon_map_.at(id)->og_color;
     }
@@ -111,8 +388,9 @@ Color Datastructures::get_color(BeaconID id)
     }
 }
 
-std::vector<BeaconID> Datastructures::beacons_alphabetically()
+std::vector<BeaconID> Datastructures::beacons_alphabetically() const
 {
+    auto lock = read_lock();
     std::vector<BeaconID> result = {};
     for (const auto& [name, beaconptr] : name_map_ ) {
         result.push_back(beaconptr->id);
@@ -120,8 +398,9 @@ std::vector<BeaconID> Datastructures::beacons_alphabetically()
     return result;
 }
 
-std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
+std::vector<BeaconID> Datastructures::beacons_brightness_increasing() const
 {
+    auto lock = read_lock();
     std::vector<BeaconID> result = {};
     for (const auto& [brightness, beaconptr] : brightness_map_ ) {
         result.push_back(beaconptr->id);
@@ -129,8 +408,9 @@ std::vector<BeaconID> Datastructures::beacons_brightness_increasing()
     return result;
 }
 
-BeaconID Datastructures::min_brightness()
+BeaconID Datastructures::min_brightness() const
 {
+    auto lock = read_lock();
     if (brightness_map_.empty()) {
         return NO_BEACON;
     }
@@ -138,8 +418,9 @@ BeaconID Datastructures::min_brightness()
     return brightness_map_.begin()->second->id;
 }
 
-BeaconID Datastructures::max_brightness()
+BeaconID Datastructures::max_brightness() const
 {
+    auto lock = read_lock();
     if (brightness_map_.empty()) {
         return NO_BEACON;
     }
@@ -151,8 +432,9 @@ BeaconID Datastructures::max_brightness()
     return max_b_it->second->id;
 }
 
-std::vector<BeaconID> Datastructures::find_beacons(Name const& name)
+std::vector<BeaconID> Datastructures::find_beacons(Name const& name) const
 {
+    auto lock = read_lock();
     std::vector<BeaconID> result = {};
     auto range = name_map_.equal_range(name);
     for (auto& i = range.first; i != range.second; ++i) {
@@ -164,6 +446,7 @@ std::vector<BeaconID> Datastructures::find_beacons(Name const& name)
 
 bool Datastructures::change_beacon_name(BeaconID id, const Name& newname)
 {
+    auto lock = write_lock();
     if (beacon_map_.contains(id)) {
         auto range = name_map_.equal_range(beacon_map_.at(id)->name);
         auto& i = range.first;
@@ -185,6 +468,7 @@ bool Datastructures::change_beacon_name(BeaconID id, const Name& newname)
 
 bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
 {
+    auto lock = write_lock();
     //Check that both beacons exist. Check that source beacon isn't already
     //beaming someone else.
     if (!beacon_map_.contains(sourceid) || !beacon_map_.contains(targetid)
@@ -219,8 +503,9 @@ bool Datastructures::add_lightbeam(BeaconID sourceid, BeaconID targetid)
     return true;
 }
 
-std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
+std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id) const
 {
+    auto lock = read_lock();
     std::vector<BeaconID> result = {};
 
     if (!beacon_map_.contains(id)) {
@@ -236,8 +521,9 @@ std::vector<BeaconID> Datastructures::get_lightsources(BeaconID id)
     return result;
 }
 
-std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
+std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id) const
 {
+    auto lock = read_lock();
     //shii
     std::vector<BeaconID> result = {};
     if (!beacon_map_.contains(id)) {
@@ -259,8 +545,9 @@ std::vector<BeaconID> Datastructures::path_outbeam(BeaconID id)
     return result;
 }
 
-std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id)
+std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id) const
 {
+    auto lock = read_lock();
     std::vector<BeaconID> longest_inbeam_route = {};
     if (!beacon_map_.contains(id)) {
         longest_inbeam_route.push_back(NO_BEACON);
@@ -271,8 +558,9 @@ std::vector<BeaconID> Datastructures::path_inbeam_longest(BeaconID id)
     return longest_inbeam_route;
 }
 
-Color Datastructures::total_color(BeaconID id)
+Color Datastructures::total_color(BeaconID id) const
 {
+    auto lock = read_lock();
     if (!beacon_map_.contains(id)) {
         return NO_COLOR;
     }
@@ -282,111 +570,196 @@ Color Datastructures::total_color(BeaconID id)
 
 bool Datastructures::add_fibre(Coord xpoint1, Coord xpoint2, Cost cost)
 {
+    auto lock = write_lock();
     if (xpoint1 == xpoint2) {
         return false;
     }
     //Try emplacing the coords to fibers.
     //If one already exists -> nothing happens.
-    fibres_.try_emplace(xpoint1, std::make_shared<Fibre_node>(xpoint1));
-    fibres_.try_emplace(xpoint2, std::make_shared<Fibre_node>(xpoint2));
-    std::shared_ptr<Fibre_node> node1 = fibres_.at(xpoint1);
-    std::shared_ptr<Fibre_node> node2 = fibres_.at(xpoint2);
+    std::shared_ptr<Fibre_node> node1 = get_or_add_fibre_node(xpoint1);
+    std::shared_ptr<Fibre_node> node2 = get_or_add_fibre_node(xpoint2);
 
     //Check if the fiber nodes are connected.
     //If yes do nothing and return false.
     //If not connect them and return true.
-    if (node1->edges.contains(xpoint2)) {
+    if (find_fibre(node1->id, node2->id) != -1) {
         return false;
     }
-    node1->edges.emplace(xpoint2, cost);
-    node2->edges.emplace(xpoint1, cost);
-
-    //Add fibre to unique_fibres.
-    //Make sure pair.first < pair.second.
-    if (xpoint1 < xpoint2) {
-        unique_fibres_.emplace(xpoint1, xpoint2);
+    int id = fibre_table_.size();
+    if (!free_fibre_ids_.empty()) {
+        id = free_fibre_ids_.back();
+        free_fibre_ids_.pop_back();
     } else {
-        unique_fibres_.emplace(xpoint2, xpoint1);
+        fibre_table_.emplace_back();
     }
-
+    fibre_table_[id] = {node1->id, node2->id, cost};
+    node1->fibres.push_back(id);
+    node2->fibres.push_back(id);
+    fibre_order_.push_back(id);
+    ++fibre_count_;
+    min_fibre_cost_ = std::min(min_fibre_cost_, cost);
+    max_fibre_cost_ = std::max(max_fibre_cost_, cost);
+    fibres_changed();
+    repair_path_trees_added(node1->id, node2->id, cost);
+
+    int component1 = connectivity_.component(node1->id);
+    int component2 = connectivity_.component(node2->id);
+    connectivity_.add_edge(node1->id, node2->id);
+    witness_cycles_added(node1->id, node2->id, component1, component2);
     return true;
 }
 
-std::vector<Coord> Datastructures::all_xpoints()
+std::vector<Coord> Datastructures::all_xpoints() const
 {
-    std::vector<Coord> result = {};
-    //Iterate through all fibers.
-    for (const auto& [coord, ptr] : fibres_) {
-        result.push_back(coord);
+    auto lock = read_lock();
+    std::lock_guard order_lock(order_mutex_);
+    sort_xpoint_order();
+    return xpoint_order_;
+}
+
+void Datastructures::sort_xpoint_order() const
+{
+    if (xpoints_removed_) {
+        //Filtering keeps the sorted prefix sorted.
+        std::size_t kept = 0;
+        std::size_t kept_sorted = 0;
+        for (std::size_t i = 0; i < xpoint_order_.size(); ++i) {
+            if (fibres_.contains(xpoint_order_[i])) {
+                xpoint_order_[kept++] = xpoint_order_[i];
+                if (i < xpoint_order_sorted_) {
+                    kept_sorted = kept;
+                }
+            }
+        }
+        xpoint_order_.resize(kept);
+        xpoint_order_sorted_ = kept_sorted;
+        xpoints_removed_ = false;
+    }
+    auto middle = xpoint_order_.begin() + xpoint_order_sorted_;
+    if (middle != xpoint_order_.end()) {
+        std::sort(middle, xpoint_order_.end());
+        std::inplace_merge(xpoint_order_.begin(), middle, xpoint_order_.end());
+        //An xpoint removed and added again is in both parts.
+        xpoint_order_.erase(std::unique(xpoint_order_.begin(), xpoint_order_.end()), xpoint_order_.end());
+        xpoint_order_sorted_ = xpoint_order_.size();
     }
-    //Sort coordinates.
-    std::sort(result.begin(), result.end());
-    return result;
 }
 
-std::vector<std::pair<Coord, Cost> > Datastructures::get_fibres_from(Coord xpoint)
+std::vector<std::pair<Coord, Cost> > Datastructures::get_fibres_from(Coord xpoint) const
 {
+    auto lock = read_lock();
     std::vector<std::pair<Coord, Cost>> fibres_from = {};
     if (!fibres_.contains(xpoint)) {
         return fibres_from;
     }
 
-    //Iterate through the map edges. push back edges in to vector.
-    //Edges are already sorted by coordinate.
-    for (const auto& [goes_to, with_cost] : fibres_.at(xpoint)->edges) {
-        fibres_from.push_back(std::make_pair(goes_to, with_cost));
+    //Collect the other ends of the fibres and sort them by coordinate.
+    const Fibre_node& node = *fibres_.at(xpoint);
+    for (int fibre : node.fibres) {
+        const Fibre& f = fibre_table_[fibre];
+        fibres_from.emplace_back(nodes_by_id_[f.other(node.id)]->location, f.cost);
     }
+    std::sort(fibres_from.begin(), fibres_from.end());
     return fibres_from;
 }
 
-std::vector<std::pair<Coord, Coord> > Datastructures::all_fibres()
+std::vector<std::pair<Coord, Coord> > Datastructures::all_fibres() const
 {
+    auto lock = read_lock();
+    std::lock_guard order_lock(order_mutex_);
+    compact_fibre_order();
+    //Sort the fibres added since the last call and merge them in.
+    auto by_coords = [this](int a, int b) {
+        return fibre_coords(a) < fibre_coords(b);
+    };
+    auto middle = fibre_order_.begin() + fibre_order_sorted_;
+    std::sort(middle, fibre_order_.end(), by_coords);
+    std::inplace_merge(fibre_order_.begin(), middle, fibre_order_.end(), by_coords);
+    fibre_order_sorted_ = fibre_order_.size();
+
     std::vector<std::pair<Coord, Coord>> result = {};
-    for (const auto& fibre: unique_fibres_) {
-        result.push_back(fibre);
+    result.reserve(fibre_order_.size());
+    for (int fibre : fibre_order_) {
+        result.push_back(fibre_coords(fibre));
     }
     return result;
 }
 
 bool Datastructures::remove_fibre(Coord xpoint1, Coord xpoint2)
 {
-    std::pair<Coord, Coord> fibre = std::make_pair(NO_COORD, NO_COORD);
-    //Check which coord is smaller.
-    if (xpoint1 < xpoint2) {
-        fibre = {xpoint1, xpoint2};
-    }
-    else {
-        fibre = {xpoint2, xpoint1};
-    }
-
+    auto lock = write_lock();
     //Check if fibre exists.
-    if (!unique_fibres_.contains(fibre)) {
+    auto it1 = fibres_.find(xpoint1);
+    auto it2 = fibres_.find(xpoint2);
+    if (it1 == fibres_.end() || it2 == fibres_.end()) {
+        return false;
+    }
+    std::shared_ptr<Fibre_node> f1 = it1->second;
+    std::shared_ptr<Fibre_node> f2 = it2->second;
+    int id = find_fibre(f1->id, f2->id);
+    if (id == -1) {
         return false;
     }
-    unique_fibres_.erase(fibre);
-
-    std::shared_ptr<Fibre_node> f1 = fibres_.at(xpoint1);
-    std::shared_ptr<Fibre_node> f2 = fibres_.at(xpoint2);
-    f1->edges.erase(xpoint2);
-    f2->edges.erase(xpoint1);
 
-    if (f1->edges.empty()) {
-        fibres_.erase(xpoint1);
+    //Removed fibre ids stay out of use until fibre_order_ forgets them.
+    fibre_table_[id].from = -1;
+    fibre_table_[id].to = -1;
+    for (Fibre_node* node : {f1.get(), f2.get()}) {
+        node->fibres.erase(std::find(node->fibres.begin(), node->fibres.end(), id));
+    }
+    removed_fibre_ids_.push_back(id);
+    --fibre_count_;
+    if (removed_fibre_ids_.size() > fibre_count_) {
+        compact_fibre_order();
     }
-    if (f2->edges.empty()) {
-        fibres_.erase(xpoint2);
+    fibres_changed();
+    repair_path_trees_removed(f1->id, f2->id);
+    int component = connectivity_.component(f1->id);
+    connectivity_.remove_edge(f1->id, f2->id);
+    witness_cycles_removed(f1->id, f2->id, component);
+
+    if (f1->fibres.empty()) {
+        erase_fibre_node(xpoint1);
+    }
+    if (f2->fibres.empty()) {
+        erase_fibre_node(xpoint2);
     }
     return true;
 }
 
 void Datastructures::clear_fibres()
 {
+    auto lock = write_lock();
     fibres_.clear();
-    unique_fibres_.clear();
+    fibre_table_.clear();
+    free_fibre_ids_.clear();
+    removed_fibre_ids_.clear();
+    fibre_count_ = 0;
+    fibre_order_.clear();
+    fibre_order_sorted_ = 0;
+    xpoint_order_.clear();
+    xpoint_order_sorted_ = 0;
+    xpoints_removed_ = false;
+    xpoint_grid_.clear();
+    nodes_by_id_.clear();
+    free_node_ids_.clear();
+    min_fibre_cost_ = 0;
+    max_fibre_cost_ = 0;
+    landmark_d_.clear();
+    ch_up_.clear();
+    ch_order_.clear();
+    hub_offset_.clear();
+    hub_ranks_.clear();
+    hub_costs_.clear();
+    clear_path_trees();
+    connectivity_.clear();
+    witness_cycles_.clear();
+    fibres_changed();
 }
 
-std::vector<std::pair<Coord, Cost> > Datastructures::route_any(Coord fromxpoint, Coord toxpoint)
+std::vector<std::pair<Coord, Cost> > Datastructures::route_any(Coord fromxpoint, Coord toxpoint) const
 {
+    auto lock = read_lock();
     //Breadth first search
     //result will be stored in this vector
     std::vector<std::pair<Coord, Cost>> route = {};
@@ -395,166 +768,350 @@ std::vector<std::pair<Coord, Cost> > Datastructures::route_any(Coord fromxpoint,
     if (!fibres_.contains(fromxpoint) || !fibres_.contains(toxpoint)) {
         return route;
     }
+    //Different components, no route.
+    if (!connected(fibres_.at(fromxpoint)->id, fibres_.at(toxpoint)->id)) {
+        return route;
+    }
 
-    //Initialize all nodes to be WHITE, have d=inf, pi=NIL.
-    reset_fibre_graph_state();
+    //New epoch. Nodes are WHITE, d=inf, pi=NIL once touched.
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
 
     //Q works as a checklist for the BFS
-    std::deque<std::shared_ptr<Fibre_node>> Q = {};
+    std::deque<int> Q = {};
 
-    std::shared_ptr<Fibre_node> s = fibres_.at(fromxpoint);
-    s->color = GRAY;
-    s->d = 0;
+    int s = fibres_.at(fromxpoint)->id;
+    S.touch(s);
+    S.color[s] = GRAY;
+    S.d[s] = 0;
     Q.push_back(s);
 
     //v is used on this block level
-    std::shared_ptr<Fibre_node> v = nullptr;
+    int v = -1;
 
     while (!Q.empty()) {
-        std::shared_ptr<Fibre_node> u = Q.front();
+        int u = Q.front();
         Q.pop_front();
-        for (const auto& [coord, cost] : u->edges) {
-            v = fibres_.at(coord);
-            if (v->color == WHITE) {
-                v->color = GRAY;
-                v->d = u->d+cost;
-                v->path_back = u;
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            v = fibre_table_[fibre].other(u);
+            Cost cost = fibre_table_[fibre].cost;
+            S.touch(v);
+            if (S.color[v] == WHITE) {
+                S.color[v] = GRAY;
+                S.d[v] = S.d[u]+cost;
+                S.path_back[v] = u;
                 Q.push_back(v);
             }
-            if (v->location == toxpoint) {
+            if (nodes_by_id_[v]->location == toxpoint) {
                 Q.clear();
                 break;
             }
         }
-        u->color = BLACK;
+        S.color[u] = BLACK;
     }
-    if (v->location == toxpoint) {
-        while (v->path_back != nullptr) {
-            route.push_back(std::make_pair(v->location, v->d));
-            v = v->path_back;
-        }
-        route.push_back(std::make_pair(fromxpoint, s->d));
-        std::reverse(route.begin(), route.end());
+    if (v != -1 && nodes_by_id_[v]->location == toxpoint) {
+        route = build_route(S, v);
+    }
+    return route;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::route_least_xpoints(Coord fromxpoint, Coord toxpoint) const
+{
+    auto lock = read_lock();
+    Route_key key = {Route_kind::LEAST_XPOINTS, fromxpoint, toxpoint};
+    std::vector<std::pair<Coord, Cost>> route = {};
+    if (cached_route(key, route)) {
+        return route;
     }
+    route = search_least_xpoints(fromxpoint, toxpoint);
+    cache_route(key, route);
     return route;
 }
 
-std::vector<std::pair<Coord, Cost>> Datastructures::route_least_xpoints(Coord fromxpoint, Coord toxpoint)
+std::vector<std::pair<Coord, Cost>> Datastructures::route_fastest(Coord fromxpoint, Coord toxpoint) const
 {
-    return route_any(fromxpoint, toxpoint);
+    auto lock = read_lock();
+    Route_key key = {Route_kind::FASTEST, fromxpoint, toxpoint};
+    std::vector<std::pair<Coord, Cost>> route = {};
+    if (cached_route(key, route)) {
+        return route;
+    }
+    route = search_fastest(fromxpoint, toxpoint);
+    cache_route(key, route);
+    return route;
 }
 
-std::vector<std::pair<Coord, Cost>> Datastructures::route_fastest(Coord fromxpoint, Coord toxpoint)
+std::vector<std::pair<Coord, Cost>> Datastructures::search_least_xpoints(Coord fromxpoint, Coord toxpoint) const
 {
-    //Dijkstras algorithm
-    std::vector<std::pair<Coord, Cost>> fastest_route = {};
+    return least_xpoints_between(search_, search_back_, fromxpoint, toxpoint);
+}
 
+std::vector<std::pair<Coord, Cost>> Datastructures::least_xpoints_between(Search_state& F, Search_state& B,
+                                                                          Coord fromxpoint, Coord toxpoint) const
+{
+    std::vector<std::pair<Coord, Cost>> route = {};
     if (!fibres_.contains(fromxpoint) || !fibres_.contains(toxpoint)) {
+        return route;
+    }
+    int s = fibres_.at(fromxpoint)->id;
+    int t = fibres_.at(toxpoint)->id;
+    if (s == t) {
+        route.emplace_back(fromxpoint, 0);
+        return route;
+    }
+    if (!connected(s, t)) {
+        return route;
+    }
+
+    //Bidirectional BFS. d is the number of hops here, not the cost.
+    F.begin(nodes_by_id_.size());
+    B.begin(nodes_by_id_.size());
+    F.touch(s);
+    F.color[s] = GRAY;
+    F.d[s] = 0;
+    B.touch(t);
+    B.color[t] = GRAY;
+    B.d[t] = 0;
+    std::vector<int> front_f = {s};
+    std::vector<int> front_b = {t};
+
+    //Best route is s -> meet_f, meet_f - meet_b, meet_b -> t.
+    int best = -1;
+    int meet_f = -1;
+    int meet_b = -1;
+    while (best == -1 && !front_f.empty() && !front_b.empty()) {
+        //Expand one whole level of the smaller frontier.
+        bool forward = front_f.size() <= front_b.size();
+        Search_state& A = forward ? F : B;
+        Search_state& O = forward ? B : F;
+        std::vector<int>& front = forward ? front_f : front_b;
+        std::vector<int> next = {};
+        for (int u : front) {
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                //The other side has reached v, the frontiers meet.
+                //The whole level is still checked for a shorter meeting.
+                O.touch(v);
+                if (O.d[v] != -1 && (best == -1 || A.d[u] + 1 + O.d[v] < best)) {
+                    best = A.d[u] + 1 + O.d[v];
+                    meet_f = forward ? u : v;
+                    meet_b = forward ? v : u;
+                }
+                A.touch(v);
+                if (A.color[v] == WHITE) {
+                    A.color[v] = GRAY;
+                    A.d[v] = A.d[u] + 1;
+                    A.path_back[v] = u;
+                    next.push_back(v);
+                }
+            }
+            A.color[u] = BLACK;
+        }
+        front = std::move(next);
+    }
+    if (best == -1) {
+        return route;
+    }
+
+    std::vector<int> path = {};
+    for (int v = meet_f; v != -1; v = F.path_back[v]) {
+        path.push_back(v);
+    }
+    std::reverse(path.begin(), path.end());
+    for (int v = meet_b; v != -1; v = B.path_back[v]) {
+        path.push_back(v);
+    }
+    return route_with_costs(path);
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::search_fastest(Coord fromxpoint, Coord toxpoint) const
+{
+    //Dijkstras algorithm
+    std::vector<std::pair<Coord, Cost>> fastest_route = {};
+    int s = -1;
+    int t = -1;
+    if (fastest_without_search(fromxpoint, toxpoint, fastest_route, s, t)) {
         return fastest_route;
     }
-    //Change all nodes to white, d to inf, path_back to NIL.
-    reset_fibre_graph_state();
 
-    //Priority queue ordered by d.
-    std::priority_queue<std::shared_ptr<Fibre_node>,
-                        std::vector<std::shared_ptr<Fibre_node>>, Cmp_fibre_ptrs> Q = {};
+    //Landmark preprocessing uses search_ too, so it has to be done first.
+    prepare_route_engine();
+    return fastest_between(search_, search_back_, s, t);
+}
 
-    std::shared_ptr<Fibre_node> s = fibres_.at(fromxpoint);
-    s->color = GRAY;
-    s->d = 0;
-    Q.push(s);
+bool Datastructures::fastest_without_search(Coord fromxpoint, Coord toxpoint,
+                                            std::vector<std::pair<Coord, Cost>>& fastest_route,
+                                            int& s, int& t) const
+{
+    if (!fibres_.contains(fromxpoint) || !fibres_.contains(toxpoint)) {
+        return true;
+    }
+    s = fibres_.at(fromxpoint)->id;
+    t = fibres_.at(toxpoint)->id;
+    if (!connected(s, t)) {
+        return true;
+    }
 
-    //Dijkstras algorithm.
-    while (!Q.empty()) {
-        std::shared_ptr<Fibre_node> u = Q.top();
-        Q.pop();
-        for (const auto& [coord, edges] : u->edges) {
-            std::shared_ptr<Fibre_node> v = fibres_.at(coord);
-            if (relax(u, v)) {
-                if (v->color == WHITE) {
-                    v->color = GRAY;
-                }
-                Q.push(v);
-            }
+    //Hub source, the route is already in its shortest path tree.
+    auto walk_tree = [&](const Path_tree& tree) {
+        if (tree.d[t] == -1) {
+            return;
         }
-        u->color = BLACK;
+        for (int v = t; v != -1; v = tree.path_back[v]) {
+            fastest_route.emplace_back(nodes_by_id_[v]->location, tree.d[v]);
+        }
+        std::reverse(fastest_route.begin(), fastest_route.end());
+    };
+    std::unique_lock tree_lock(path_tree_mutex_);
+    if (const Path_tree* tree = find_path_tree(s)) {
+        walk_tree(*tree);
+        return true;
+    }
+    if (!claim_path_tree(s)) {
+        return false;
+    }
+    //The full Dijkstra only reads the graph, other queries can use the
+    //cached trees meanwhile.
+    tree_lock.unlock();
+    Path_tree tree = build_path_tree(s);
+    walk_tree(tree);
+    tree_lock.lock();
+    store_path_tree(std::move(tree));
+    return true;
+}
+
+bool Datastructures::ch_usable() const
+{
+    return route_engine_ == Route_engine::CH && min_fibre_cost_ >= 0;
+}
+
+void Datastructures::prepare_route_engine() const
+{
+    std::lock_guard engine_lock(engine_mutex_);
+    if (route_engine_ == Route_engine::ALT) {
+        update_landmarks();
+    }
+    if (ch_usable()) {
+        update_contraction_hierarchy();
+    }
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::fastest_between(Search_state& S, Search_state& Sb,
+                                                                    int s, int t) const
+{
+    std::vector<std::pair<Coord, Cost>> fastest_route = {};
+    if (ch_usable()) {
+        return ch_route(S, Sb, s, t);
     }
-    s = fibres_.at(toxpoint);
 
-    //S wasn't reached it it's still white
-    if (s->color == WHITE) {
+    //New epoch. Nodes are WHITE, d=inf, pi=NIL once touched.
+    S.begin(nodes_by_id_.size());
+
+    if (route_engine_ == Route_engine::BIDIRECTIONAL) {
+        Sb.begin(nodes_by_id_.size());
+        with_route_queue(max_fibre_cost_, [&](auto& Q) {
+            //Q is still empty, so this is a second empty queue of the same type.
+            auto Qb = Q;
+            fastest_route = bidirectional_dijkstra(S, Q, Sb, Qb, s, t);
+        });
         return fastest_route;
     }
 
-    //Traverse through the route backwards.
-    while (s != nullptr) {
-        fastest_route.emplace_back(s->location, s->d);
-        s = s->path_back;
+    //ALT needs non-negative costs for the triangle inequality.
+    if (route_engine_ == Route_engine::ALT && min_fibre_cost_ >= 0) {
+        //Reduced cost of a fibre is at most 2*cost, so keys in the queue
+        //span at most 2*C.
+        with_route_queue(2 * max_fibre_cost_, [&](auto& Q) {
+            alt_search(S, Q, s, t);
+        });
+    } else {
+        //Stop as soon as t is settled, its d can't change anymore.
+        unsigned long long settled = 0;
+        with_route_queue(max_fibre_cost_, [&](auto& Q) {
+            dijkstra(S, Q, s, [&settled, t](int u) {
+                ++settled;
+                return u != t;
+            });
+        });
+        settled_count_ += settled;
+    }
+
+    S.touch(t);
+    //t wasn't reached it it's still white
+    if (S.color[t] == WHITE) {
+        return fastest_route;
     }
-    std::reverse(fastest_route.begin(), fastest_route.end());
-    return fastest_route;
+    return build_route(S, t);
 }
 
-std::vector<Coord> Datastructures::route_fibre_cycle(Coord startxpoint)
+std::vector<Coord> Datastructures::route_fibre_cycle(Coord startxpoint) const
 {
+    auto lock = read_lock();
     std::vector<Coord> loop = {};
     //Check point exists
     if (!fibres_.contains(startxpoint)) {
         return loop;
     }
 
-    reset_fibre_graph_state();
-
-    std::stack<std::shared_ptr<Fibre_node>> S = {};
+    int s = fibres_.at(startxpoint)->id;
+    std::vector<int> cycle = {};
+    {
+        std::lock_guard witness_lock(witness_mutex_);
+        const std::vector<int>* witness = witness_cycle(s);
+        if (witness == nullptr) {
+            return loop;
+        }
+        cycle = *witness;
+    }
 
-    std::shared_ptr<Fibre_node> s = fibres_.at(startxpoint);
-    //Initialize u, v here. They are needed after the while loop.
-    std::shared_ptr<Fibre_node> u = nullptr;
-    std::shared_ptr<Fibre_node> v = nullptr;
-    bool loop_found = false;
-    S.push(s);
+    //Nodes of the cycle are gray and remember their index in it.
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
+    for (std::size_t i = 0; i < cycle.size(); ++i) {
+        S.touch(cycle[i]);
+        S.color[cycle[i]] = GRAY;
+        S.d[cycle[i]] = i;
+    }
 
-    //Depth first search
-    while (!S.empty()) {
-        u = S.top();
-        S.pop();
-        if (u->color == WHITE) {
-            u->color = GRAY;
-            S.push(u);
-            for (const auto& [coord, cost] : u->edges) {
-                v = fibres_.at(coord);
-                if (u->path_back == v) {
-                    continue;
-                }
-                if (v->color == WHITE) {
-                    v->path_back = u;
-                    S.push(v);
-                }
-                //loop found
-                else if (v->color == GRAY) {
-                    loop_found = true;
-                    //Fullfill outer while loops condition.
-                    while (!S.empty()) {
-                        S.pop();
-                    }
-                    //Break inner for loop.
+    //Breadth first search from start to the closest node of the cycle.
+    int entry = s;
+    int last = -1;
+    S.touch(s);
+    if (S.color[s] != GRAY) {
+        std::queue<int> Q = {};
+        S.color[s] = BLACK;
+        Q.push(s);
+        entry = -1;
+        while (!Q.empty() && entry == -1) {
+            int u = Q.front();
+            Q.pop();
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                S.touch(v);
+                if (S.color[v] == GRAY) {
+                    entry = v;
+                    last = u;
                     break;
                 }
+                if (S.color[v] == WHITE) {
+                    S.color[v] = BLACK;
+                    S.path_back[v] = u;
+                    Q.push(v);
+                }
             }
-
-        } else {
-            u->color = BLACK;
         }
     }
-    if (!loop_found) {
-        return loop;
-    }
-    loop.push_back(v->location);
-    while (u != nullptr) {
-        loop.push_back(u->location);
-        u = u->path_back;
+
+    //Route from start to the cycle
+    for (int u = last; u != -1; u = S.path_back[u]) {
+        loop.push_back(nodes_by_id_[u]->location);
     }
     std::reverse(loop.begin(), loop.end());
+    //and once around it back to the entry node.
+    std::size_t first = S.d[entry];
+    for (std::size_t i = 0; i <= cycle.size(); ++i) {
+        loop.push_back(nodes_by_id_[cycle[(first + i) % cycle.size()]]->location);
+    }
     return loop;
 }
 
@@ -599,47 +1156,2373 @@ Color Datastructures::get_total_color(BeaconID id) const
     return tc;
 }
 
-void Datastructures::reset_fibre_graph_state()
+void Datastructures::set_route_engine(Route_engine engine)
 {
-    //Change nodes to have color=WHITE, d=infity, pi=NIL.
-    for (const auto& [xy, fibre_ptr] : fibres_) {
-        fibre_ptr->color = WHITE;
-        fibre_ptr->d = -1;
-        fibre_ptr->path_back = nullptr;
+    auto lock = write_lock();
+    if (engine == route_engine_) {
+        return;
     }
+    route_engine_ = engine;
+    route_cache_.clear();
+    route_cache_index_.clear();
+    clear_path_trees();
 }
 
-bool Datastructures::relax(std::shared_ptr<Fibre_node> u, std::shared_ptr<Fibre_node> v)
+Datastructures::Route_engine Datastructures::route_engine() const
 {
-    int costUV = u->edges.at(v->location);
-    if (v->d > u->d+costUV || v->d == -1) {
-        v->d = u->d+costUV;
-        v->path_back = u;
-        return true;
-    }
-    return false;
+    auto lock = read_lock();
+    return route_engine_;
 }
 
-/*std::shared_ptr<Datastructures::Fibre_node> Datastructures::dfs_recursive(std::shared_ptr<Fibre_node> s)
+unsigned long long Datastructures::settled_count() const
 {
-    s->color = GRAY;
-    for (const auto& [coord, cost] : s->edges) {
-        std::shared_ptr<Fibre_node> v = fibres_.at(coord);
-        if (v->color == WHITE) {
-            v->path_back = s;
-            v = dfs_recursive(v);
-            if (v->color == BLACK) {
-                return v;
+    auto lock = read_lock();
+    return settled_count_;
+}
+
+void Datastructures::reset_settled_count()
+{
+    auto lock = write_lock();
+    settled_count_ = 0;
+}
+
+std::vector<Cost> Datastructures::route_costs(Coord fromxpoint, std::vector<Coord> const& toxpoints) const
+{
+    auto lock = read_lock();
+    if (!fibres_.contains(fromxpoint)) {
+        return std::vector<Cost>(toxpoints.size(), NO_COST);
+    }
+    std::vector<int> target_ids = {};
+    for (Coord xy : toxpoints) {
+        auto it = fibres_.find(xy);
+        target_ids.push_back(it == fibres_.end() ? -1 : it->second->id);
+    }
+    int s = fibres_.at(fromxpoint)->id;
+    {
+        std::lock_guard tree_lock(path_tree_mutex_);
+        if (const Path_tree* tree = find_path_tree(s)) {
+            std::vector<Cost> costs = {};
+            for (int id : target_ids) {
+                costs.push_back(id == -1 || tree->d[id] == -1 ? NO_COST : tree->d[id]);
             }
+            return costs;
         }
-        if (s->path_back != v && v->color == GRAY) {
-            v->color = BLACK;
-            return s;
+    }
+    return costs_from(search_, s, target_ids);
+}
+
+std::vector<std::vector<Cost>> Datastructures::route_cost_matrix(std::vector<Coord> const& fromxpoints,
+                                                                 std::vector<Coord> const& toxpoints) const
+{
+    auto lock = read_lock();
+    std::vector<std::vector<Cost>> result(fromxpoints.size());
+    std::vector<int> target_ids = {};
+    for (Coord xy : toxpoints) {
+        auto it = fibres_.find(xy);
+        target_ids.push_back(it == fibres_.end() ? -1 : it->second->id);
+    }
+    std::vector<int> source_ids = {};
+    for (Coord xy : fromxpoints) {
+        auto it = fibres_.find(xy);
+        source_ids.push_back(it == fibres_.end() ? -1 : it->second->id);
+    }
+
+    //Every thread takes the next unhandled row until all are done.
+    parallel_for(source_ids.size(), [&]() {
+        return [&, S = Search_state()](std::size_t i) mutable {
+            if (source_ids[i] == -1) {
+                result[i].assign(target_ids.size(), NO_COST);
+            } else {
+                result[i] = costs_from(S, source_ids[i], target_ids);
+            }
+        };
+    });
+    return result;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::route_costs_all(Coord fromxpoint) const
+{
+    auto lock = read_lock();
+    std::vector<std::pair<Coord, Cost>> costs = {};
+    if (!fibres_.contains(fromxpoint)) {
+        return costs;
+    }
+    int s = fibres_.at(fromxpoint)->id;
+    std::vector<Cost> d = {};
+    if (min_fibre_cost_ >= 0) {
+        d = delta_stepping(s);
+    } else {
+        //Delta-stepping needs non-negative costs, plain Dijkstra then.
+        Search_state& S = search_;
+        S.begin(nodes_by_id_.size());
+        with_route_queue(max_fibre_cost_, [&](auto& Q) {
+            dijkstra(S, Q, s, [](int) { return true; });
+        });
+        d.assign(nodes_by_id_.size(), NO_COST);
+        for (std::size_t id = 0; id < d.size(); ++id) {
+            if (S.stamp[id] == S.epoch && S.color[id] == BLACK) {
+                d[id] = S.d[id];
+            }
         }
     }
-    return nullptr;
-}*/
 
+    std::lock_guard order_lock(order_mutex_);
+    sort_xpoint_order();
+    costs.reserve(xpoint_order_.size());
+    for (Coord xy : xpoint_order_) {
+        costs.emplace_back(xy, d[fibres_.at(xy)->id]);
+    }
+    return costs;
+}
 
+Cost Datastructures::route_cost(Coord fromxpoint, Coord toxpoint) const
+{
+    auto lock = read_lock();
+    if (!fibres_.contains(fromxpoint) || !fibres_.contains(toxpoint)) {
+        return NO_COST;
+    }
+    int s = fibres_.at(fromxpoint)->id;
+    int t = fibres_.at(toxpoint)->id;
+    if (!connected(s, t)) {
+        return NO_COST;
+    }
+    if (min_fibre_cost_ < 0) {
+        return costs_from(search_, s, {t}).front();
+    }
+    {
+        std::lock_guard label_lock(hub_label_mutex_);
+        update_hub_labels();
+    }
+    return hub_label_cost(s, t);
+}
 
+std::vector<std::pair<Coord, Cost>> Datastructures::xpoints_within_cost(Coord fromxpoint, Cost budget) const
+{
+    auto lock = read_lock();
+    std::vector<std::pair<Coord, Cost>> reached = {};
+    if (!fibres_.contains(fromxpoint) || budget < 0) {
+        return reached;
+    }
+    int s = fibres_.at(fromxpoint)->id;
+
+    //Nodes are settled in cost order, the first one over the budget ends
+    //the search. Negative fibres could still lead back under the budget.
+    bool can_stop = min_fibre_cost_ >= 0;
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
+    with_route_queue(max_fibre_cost_, [&](auto& Q) {
+        dijkstra(S, Q, s, [&](int u) {
+            if (S.d[u] > budget) {
+                return !can_stop;
+            }
+            reached.emplace_back(nodes_by_id_[u]->location, S.d[u]);
+            return true;
+        });
+    });
+    std::sort(reached.begin(), reached.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.second, a.first) < std::tie(b.second, b.first);
+    });
+    return reached;
+}
 
+BeaconID Datastructures::nearest_beacon_by_fibre(Coord xpoint) const
+{
+    auto lock = read_lock();
+    if (!fibres_.contains(xpoint) || beacons_at_.empty()) {
+        return NO_BEACON;
+    }
+    int s = fibres_.at(xpoint)->id;
+
+    //Nodes are settled in cost order. Once a beacon is found only nodes
+    //with the same cost can still have a better one (smaller id).
+    bool can_stop = min_fibre_cost_ >= 0;
+    BeaconID nearest = NO_BEACON;
+    Cost nearest_cost = NO_COST;
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
+    with_route_queue(max_fibre_cost_, [&](auto& Q) {
+        dijkstra(S, Q, s, [&](int u) {
+            if (can_stop && nearest != NO_BEACON && S.d[u] > nearest_cost) {
+                return false;
+            }
+            auto it = beacons_at_.find(nodes_by_id_[u]->location);
+            if (it != beacons_at_.end()) {
+                const BeaconID& id = *it->second.begin();
+                if (nearest == NO_BEACON || S.d[u] < nearest_cost || (S.d[u] == nearest_cost && id < nearest)) {
+                    nearest = id;
+                    nearest_cost = S.d[u];
+                }
+            }
+            return true;
+        });
+    });
+    return nearest;
+}
+
+std::size_t Datastructures::hub_label_memory() const
+{
+    auto lock = read_lock();
+    std::lock_guard label_lock(hub_label_mutex_);
+    if (min_fibre_cost_ >= 0) {
+        update_hub_labels();
+    }
+    return hub_offset_.size() * sizeof(std::size_t) + hub_ranks_.size() * sizeof(int)
+           + hub_costs_.size() * sizeof(Cost);
+}
+
+std::vector<std::vector<std::pair<Coord, Cost>>> Datastructures::route_fastest_batch(
+    std::span<const std::pair<Coord, Coord>> queries) const
+{
+    auto lock = read_lock();
+    return route_batch(Route_kind::FASTEST, queries);
+}
+
+std::vector<std::vector<std::pair<Coord, Cost>>> Datastructures::route_least_xpoints_batch(
+    std::span<const std::pair<Coord, Coord>> queries) const
+{
+    auto lock = read_lock();
+    return route_batch(Route_kind::LEAST_XPOINTS, queries);
+}
+
+std::vector<std::vector<std::pair<Coord, Cost>>> Datastructures::route_batch(
+    Route_kind kind, std::span<const std::pair<Coord, Coord>> queries) const
+{
+    std::vector<std::vector<std::pair<Coord, Cost>>> result(queries.size());
+    //Cache lookups move entries in the LRU list and path trees may be built,
+    //so everything that changes the object is done here before the threads.
+    std::vector<std::size_t> searched = {};
+    std::vector<std::pair<int, int>> ends = {};
+    std::vector<std::size_t> misses = {};
+    for (std::size_t i = 0; i < queries.size(); ++i) {
+        auto [from, to] = queries[i];
+        if (cached_route({kind, from, to}, result[i])) {
+            continue;
+        }
+        misses.push_back(i);
+        int s = -1;
+        int t = -1;
+        if (kind == Route_kind::LEAST_XPOINTS || !fastest_without_search(from, to, result[i], s, t)) {
+            searched.push_back(i);
+            ends.emplace_back(s, t);
+        }
+    }
+    if (kind == Route_kind::FASTEST && !searched.empty()) {
+        prepare_route_engine();
+    }
+
+    parallel_for(searched.size(), [&]() {
+        return [&, S = Search_state(), Sb = Search_state()](std::size_t j) mutable {
+            std::size_t i = searched[j];
+            if (kind == Route_kind::LEAST_XPOINTS) {
+                result[i] = least_xpoints_between(S, Sb, queries[i].first, queries[i].second);
+            } else {
+                result[i] = fastest_between(S, Sb, ends[j].first, ends[j].second);
+            }
+        };
+    });
+
+    for (std::size_t i : misses) {
+        cache_route({kind, queries[i].first, queries[i].second}, result[i]);
+    }
+    return result;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::route_shortest_cycle(Coord startxpoint) const
+{
+    auto lock = read_lock();
+    std::vector<std::pair<Coord, Cost>> cycle = {};
+    if (!fibres_.contains(startxpoint)) {
+        return cycle;
+    }
+    int s = fibres_.at(startxpoint)->id;
+    if (connectivity_.cycle_edge(s).first == -1) {
+        return cycle;
+    }
+
+    std::vector<int> label(nodes_by_id_.size(), -1);
+    int u = -1;
+    int w = -1;
+    if (shortest_cycle_through(s, -1, label, u, w) == -1) {
+        return cycle;
+    }
+    //s -> u from the search tree backwards, then w -> s.
+    std::vector<int> path = {};
+    for (int v = u; v != -1; v = search_.path_back[v]) {
+        path.push_back(v);
+    }
+    std::reverse(path.begin(), path.end());
+    for (int v = w; v != -1; v = search_.path_back[v]) {
+        path.push_back(v);
+    }
+    return route_with_costs(path);
+}
+
+Cost Datastructures::girth() const
+{
+    auto lock = read_lock();
+    Cost best = -1;
+    std::vector<int> label(nodes_by_id_.size(), -1);
+    for (std::size_t s = 0; s < nodes_by_id_.size(); ++s) {
+        if (nodes_by_id_[s] == nullptr || connectivity_.cycle_edge(s).first == -1) {
+            continue;
+        }
+        int u = -1;
+        int w = -1;
+        Cost cost = shortest_cycle_through(s, best, label, u, w);
+        if (cost != -1) {
+            best = cost;
+        }
+    }
+    return best == -1 ? NO_COST : best;
+}
+
+std::pair<std::vector<std::pair<Coord, Coord>>, Cost> Datastructures::minimum_spanning_backbone() const
+{
+    auto lock = read_lock();
+    struct Weighted_fibre {
+        Cost cost;
+        int from;
+        int to;
+    };
+    std::vector<Weighted_fibre> fibres = {};
+    fibres.reserve(fibre_count_);
+    for (const Fibre& fibre : fibre_table_) {
+        if (fibre.from != -1) {
+            fibres.push_back({fibre.cost, fibre.from, fibre.to});
+        }
+    }
+    std::sort(fibres.begin(), fibres.end(), [](const Weighted_fibre& a, const Weighted_fibre& b) {
+        return a.cost < b.cost;
+    });
+
+    //Union-find over node ids.
+    std::vector<int> parent(nodes_by_id_.size());
+    std::vector<int> size(nodes_by_id_.size(), 1);
+    for (std::size_t i = 0; i < parent.size(); ++i) {
+        parent[i] = i;
+    }
+    auto find = [&parent](int x) {
+        while (parent[x] != x) {
+            parent[x] = parent[parent[x]];
+            x = parent[x];
+        }
+        return x;
+    };
+
+    std::pair<std::vector<std::pair<Coord, Coord>>, Cost> backbone = {{}, 0};
+    //A spanning forest has at most nodes - 1 fibres.
+    std::size_t node_count = fibres_.size();
+    for (const Weighted_fibre& fibre : fibres) {
+        int a = find(fibre.from);
+        int b = find(fibre.to);
+        if (a == b) {
+            continue;
+        }
+        if (size[a] < size[b]) {
+            std::swap(a, b);
+        }
+        parent[b] = a;
+        size[a] += size[b];
+
+        Coord xpoint1 = nodes_by_id_[fibre.from]->location;
+        Coord xpoint2 = nodes_by_id_[fibre.to]->location;
+        if (xpoint2 < xpoint1) {
+            std::swap(xpoint1, xpoint2);
+        }
+        backbone.first.emplace_back(xpoint1, xpoint2);
+        backbone.second += fibre.cost;
+        if (backbone.first.size() + 1 == node_count) {
+            break;
+        }
+    }
+    return backbone;
+}
+
+std::vector<std::vector<std::pair<Coord, Cost>>> Datastructures::route_k_fastest(Coord fromxpoint, Coord toxpoint,
+                                                                                 unsigned int k) const
+{
+    auto lock = read_lock();
+    std::vector<std::vector<std::pair<Coord, Cost>>> routes = {};
+    if (k == 0 || !fibres_.contains(fromxpoint) || !fibres_.contains(toxpoint)) {
+        return routes;
+    }
+    int s = fibres_.at(fromxpoint)->id;
+    int t = fibres_.at(toxpoint)->id;
+    if (s == t) {
+        routes.push_back({{fromxpoint, 0}});
+        return routes;
+    }
+    if (!connected(s, t)) {
+        return routes;
+    }
+
+    //Shortest path tree of t. Fibres are undirected, so it gives the
+    //fastest route to t from every node and the heuristic for the spurs.
+    std::size_t n = nodes_by_id_.size();
+    Search_state& S = search_;
+    S.begin(n);
+    with_route_queue(max_fibre_cost_, [&](auto& Q) {
+        dijkstra(S, Q, t, [](int) { return true; });
+    });
+    std::vector<Cost> to_t(n, -1);
+    std::vector<int> toward_t(n, -1);
+    for (std::size_t id = 0; id < n; ++id) {
+        if (S.stamp[id] == S.epoch && S.color[id] == BLACK) {
+            to_t[id] = S.d[id];
+            toward_t[id] = S.path_back[id];
+        }
+    }
+
+    //Routes found so far as node ids, and candidates by (cost, route).
+    //The set also drops a candidate found again from another spur node.
+    std::vector<std::vector<int>> found = {};
+    std::set<std::pair<Cost, std::vector<int>>> candidates = {};
+    std::vector<int> first = {};
+    for (int u = s; u != -1; u = toward_t[u]) {
+        first.push_back(u);
+    }
+    candidates.emplace(to_t[s], first);
+
+    std::vector<char> node_banned(n, 0);
+    std::vector<char> fibre_banned(fibre_table_.size(), 0);
+    while (found.size() < k && !candidates.empty()) {
+        found.push_back(candidates.begin()->second);
+        candidates.erase(candidates.begin());
+        if (found.size() == k) {
+            break;
+        }
+        const std::vector<int>& previous = found.back();
+        Cost root_cost = 0;
+        for (std::size_t i = 0; i + 1 < previous.size(); ++i) {
+            int spur = previous[i];
+            //Earlier routes with the same root can't continue the same way.
+            std::vector<int> banned_fibres = {};
+            for (const std::vector<int>& route : found) {
+                if (route.size() > i + 1 && std::equal(previous.begin(), previous.begin() + i + 1, route.begin())) {
+                    int fibre = find_fibre(route[i], route[i + 1]);
+                    fibre_banned[fibre] = 1;
+                    banned_fibres.push_back(fibre);
+                }
+            }
+            //The root can't be visited again, the route would loop.
+            for (std::size_t j = 0; j < i; ++j) {
+                node_banned[previous[j]] = 1;
+            }
+
+            S.begin(n);
+            with_route_queue(2 * max_fibre_cost_, [&](auto& Q) {
+                spur_search(S, Q, spur, t, to_t, node_banned, fibre_banned);
+            });
+            S.touch(t);
+            if (S.color[t] == BLACK) {
+                std::vector<int> route(previous.begin(), previous.begin() + i);
+                std::size_t root_size = route.size();
+                for (int u = t; u != -1; u = S.path_back[u]) {
+                    route.push_back(u);
+                }
+                std::reverse(route.begin() + root_size, route.end());
+                candidates.emplace(root_cost + S.d[t], std::move(route));
+            }
+
+            for (int fibre : banned_fibres) {
+                fibre_banned[fibre] = 0;
+            }
+            for (std::size_t j = 0; j < i; ++j) {
+                node_banned[previous[j]] = 0;
+            }
+            root_cost += fibre_table_[find_fibre(spur, previous[i + 1])].cost;
+        }
+    }
+
+    for (const std::vector<int>& route : found) {
+        routes.push_back(route_with_costs(route));
+    }
+    return routes;
+}
+
+Coord Datastructures::nearest_xpoint(Coord xy) const
+{
+    auto lock = read_lock();
+    return xpoint_grid_.nearest(xy);
+}
+
+std::vector<Coord> Datastructures::xpoints_in_rect(Coord min, Coord max) const
+{
+    auto lock = read_lock();
+    std::vector<Coord> result = xpoint_grid_.in_rect(min, max, [](Coord) { return true; });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+std::vector<Coord> Datastructures::xpoints_within_radius(Coord xy, int radius) const
+{
+    auto lock = read_lock();
+    std::vector<Coord> result = {};
+    if (radius < 0) {
+        return result;
+    }
+    Spatial_grid::Wide r2 = Spatial_grid::square(radius);
+    //Bounding box of the circle, clamped to int.
+    auto clamp = [](long long v) {
+        return static_cast<int>(std::clamp<long long>(v, std::numeric_limits<int>::min(),
+                                                      std::numeric_limits<int>::max()));
+    };
+    Coord min = {clamp(static_cast<long long>(xy.x) - radius), clamp(static_cast<long long>(xy.y) - radius)};
+    Coord max = {clamp(static_cast<long long>(xy.x) + radius), clamp(static_cast<long long>(xy.y) + radius)};
+    result = xpoint_grid_.in_rect(min, max, [xy, r2](Coord c) {
+        return Spatial_grid::squared_distance(c, xy) <= r2;
+    });
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+Cost Datastructures::shortest_cycle_through(int s, Cost bound, std::vector<int>& label, int& u, int& w) const
+{
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
+    Cost best = bound;
+    //A cycle closed by a fibre between settled nodes costs at least twice
+    //the d of either end, so nothing cheaper can come after that. Only
+    //holds for non-negative costs.
+    bool can_stop = min_fibre_cost_ >= 0;
+    with_route_queue(max_fibre_cost_, [&](auto& Q) {
+        dijkstra(S, Q, s, [&](int x) {
+            if (can_stop && best != -1 && 2 * S.d[x] >= best) {
+                return false;
+            }
+            if (x == s) {
+                label[x] = -1;
+                return true;
+            }
+            int parent = S.path_back[x];
+            label[x] = parent == s ? x : label[parent];
+            //Fibres to nodes settled earlier, except the one x was reached by.
+            for (int fibre : nodes_by_id_[x]->fibres) {
+                int y = fibre_table_[fibre].other(x);
+                Cost cost = fibre_table_[fibre].cost;
+                if (y == parent || S.stamp[y] != S.epoch || S.color[y] != BLACK) {
+                    continue;
+                }
+                if (label[y] != label[x]) {
+                    Cost total = S.d[x] + cost + S.d[y];
+                    if (best == -1 || total < best) {
+                        best = total;
+                        u = x;
+                        w = y;
+                    }
+                }
+            }
+            return true;
+        });
+    });
+    return best == bound ? -1 : best;
+}
+
+std::vector<Cost> Datastructures::costs_from(Search_state& S, int s, const std::vector<int>& target_ids) const
+{
+    //Targets in other components would make the search go through the
+    //whole component of s.
+    std::unordered_set<int> remaining = {};
+    int component = connectivity_.component(s);
+    for (int id : target_ids) {
+        if (id != -1 && connectivity_.component(id) == component) {
+            remaining.insert(id);
+        }
+    }
+    S.begin(nodes_by_id_.size());
+    if (!remaining.empty()) {
+        with_route_queue(max_fibre_cost_, [&](auto& Q) {
+            dijkstra(S, Q, s, [&remaining](int u) {
+                remaining.erase(u);
+                return !remaining.empty();
+            });
+        });
+    }
+
+    std::vector<Cost> costs = {};
+    for (int id : target_ids) {
+        if (id != -1 && S.stamp[id] == S.epoch && S.color[id] == BLACK) {
+            costs.push_back(S.d[id]);
+        } else {
+            costs.push_back(NO_COST);
+        }
+    }
+    return costs;
+}
+
+std::vector<Cost> Datastructures::delta_stepping(int s) const
+{
+    std::size_t n = nodes_by_id_.size();
+    Cost const INF = std::numeric_limits<Cost>::max();
+    std::vector<std::atomic<Cost>> d(n);
+    for (std::atomic<Cost>& cost : d) {
+        cost.store(INF, std::memory_order_relaxed);
+    }
+
+    //Width of a bucket. Fibres up to delta are light and relaxed again
+    //until the bucket stays empty, heavier ones once per settled node.
+    //Average degree fibres per node keeps the rounds about as long as the
+    //buckets are wide.
+    std::size_t degree = std::max<std::size_t>(1, 2 * fibre_count_ / std::max<std::size_t>(1, fibres_.size()));
+    Cost delta = std::max<Cost>(1, max_fibre_cost_ / static_cast<Cost>(degree));
+
+    //Only buckets with nodes exist. A node is put to the bucket of its d
+    //every time d drops, entries for an older d are skipped when popped.
+    std::map<Cost, std::vector<int>> buckets = {};
+    d[s] = 0;
+    buckets[0].push_back(s);
+
+    //round[id] is the last round id was relaxed in and bucket_of[id] the
+    //last bucket it was settled in, both drop duplicate entries.
+    std::vector<unsigned> round(n, 0);
+    std::vector<Cost> bucket_of(n, -1);
+    unsigned round_count = 0;
+
+    //Relaxes the light or heavy fibres of nodes. Small rounds are done in
+    //this thread, big ones in chunks over the hardware threads. Nodes whose
+    //d dropped are collected per thread and put to their buckets after.
+    std::mutex reached_mutex;
+    auto relax_fibres = [&](const std::vector<int>& nodes, bool light) {
+        std::deque<std::vector<int>> reached = {};
+        auto make_worker = [&]() {
+            std::vector<int>* mine = nullptr;
+            {
+                std::lock_guard reached_lock(reached_mutex);
+                mine = &reached.emplace_back();
+            }
+            return [&, mine](std::size_t chunk) {
+                std::size_t end = std::min(nodes.size(), (chunk + 1) * DELTA_CHUNK);
+                for (std::size_t i = chunk * DELTA_CHUNK; i < end; ++i) {
+                    int u = nodes[i];
+                    Cost du = d[u].load(std::memory_order_relaxed);
+                    for (int fibre : nodes_by_id_[u]->fibres) {
+                        const Fibre& f = fibre_table_[fibre];
+                        if ((f.cost <= delta) != light) {
+                            continue;
+                        }
+                        int v = f.other(u);
+                        Cost dv = d[v].load(std::memory_order_relaxed);
+                        while (du + f.cost < dv) {
+                            if (d[v].compare_exchange_weak(dv, du + f.cost, std::memory_order_relaxed)) {
+                                mine->push_back(v);
+                                break;
+                            }
+                        }
+                    }
+                }
+            };
+        };
+        std::size_t chunks = (nodes.size() + DELTA_CHUNK - 1) / DELTA_CHUNK;
+        if (chunks <= 1) {
+            auto worker = make_worker();
+            for (std::size_t chunk = 0; chunk < chunks; ++chunk) {
+                worker(chunk);
+            }
+        } else {
+            parallel_for(chunks, make_worker);
+        }
+        for (const std::vector<int>& nodes_reached : reached) {
+            for (int v : nodes_reached) {
+                buckets[d[v].load(std::memory_order_relaxed) / delta].push_back(v);
+            }
+        }
+    };
+
+    while (!buckets.empty()) {
+        Cost bucket = buckets.begin()->first;
+        std::vector<int> settled = {};
+        //Light fibres can put nodes back to this bucket, repeat until empty.
+        while (!buckets.empty() && buckets.begin()->first == bucket) {
+            std::vector<int> current = std::move(buckets.begin()->second);
+            buckets.erase(buckets.begin());
+            ++round_count;
+            std::vector<int> active = {};
+            for (int u : current) {
+                if (d[u].load(std::memory_order_relaxed) / delta != bucket || round[u] == round_count) {
+                    continue;
+                }
+                round[u] = round_count;
+                active.push_back(u);
+                if (bucket_of[u] != bucket) {
+                    bucket_of[u] = bucket;
+                    settled.push_back(u);
+                }
+            }
+            relax_fibres(active, true);
+        }
+        //d of the nodes of this bucket is final now.
+        relax_fibres(settled, false);
+    }
+
+    std::vector<Cost> result(n, NO_COST);
+    for (std::size_t id = 0; id < n; ++id) {
+        Cost cost = d[id].load(std::memory_order_relaxed);
+        if (cost != INF) {
+            result[id] = cost;
+        }
+    }
+    return result;
+}
+
+unsigned long long Datastructures::route_cache_hits() const
+{
+    auto lock = read_lock();
+    std::lock_guard cache_lock(route_cache_mutex_);
+    return route_cache_hits_;
+}
+
+unsigned long long Datastructures::route_cache_misses() const
+{
+    auto lock = read_lock();
+    std::lock_guard cache_lock(route_cache_mutex_);
+    return route_cache_misses_;
+}
+
+void Datastructures::set_route_cache_capacity(std::size_t capacity)
+{
+    auto lock = write_lock();
+    route_cache_capacity_ = capacity;
+    while (route_cache_.size() > route_cache_capacity_) {
+        route_cache_index_.erase(route_cache_.back().key);
+        route_cache_.pop_back();
+    }
+}
+
+void Datastructures::set_path_tree_memory_limit(std::size_t bytes)
+{
+    auto lock = write_lock();
+    path_tree_memory_limit_ = bytes;
+    trim_path_trees();
+}
+
+const Datastructures::Path_tree* Datastructures::find_path_tree(int s) const
+{
+    auto it = path_tree_index_.find(s);
+    if (it == path_tree_index_.end()) {
+        return nullptr;
+    }
+    if (it->second->version == graph_version_) {
+        path_trees_.splice(path_trees_.begin(), path_trees_, it->second);
+        return &*it->second;
+    }
+    //Built for older fibres.
+    path_tree_memory_ -= it->second->d.size() * (sizeof(Cost) + sizeof(int));
+    path_trees_.erase(it->second);
+    path_tree_index_.erase(it);
+    return nullptr;
+}
+
+bool Datastructures::claim_path_tree(int s) const
+{
+    //Counts start over when the fibres change.
+    if (source_counts_version_ != graph_version_) {
+        source_query_counts_.clear();
+        source_counts_version_ = graph_version_;
+    }
+    std::size_t bytes = nodes_by_id_.size() * (sizeof(Cost) + sizeof(int));
+    if (++source_query_counts_[s] < PATH_TREE_THRESHOLD || bytes > path_tree_memory_limit_) {
+        return false;
+    }
+    //Other queries from s count from zero again, so they don't build the
+    //same tree while this one is being built.
+    source_query_counts_.erase(s);
+    return true;
+}
+
+Datastructures::Path_tree Datastructures::build_path_tree(int s) const
+{
+    //Full Dijkstra, no target to stop at.
+    std::size_t n = nodes_by_id_.size();
+    Search_state& S = search_;
+    S.begin(n);
+    unsigned long long settled = 0;
+    with_route_queue(max_fibre_cost_, [&](auto& Q) {
+        dijkstra(S, Q, s, [&settled](int) { ++settled; return true; });
+    });
+    settled_count_ += settled;
+    Path_tree tree = {s, graph_version_, std::vector<Cost>(n, -1), std::vector<int>(n, -1)};
+    for (std::size_t id = 0; id < n; ++id) {
+        if (S.stamp[id] == S.epoch && S.color[id] == BLACK) {
+            tree.d[id] = S.d[id];
+            tree.path_back[id] = S.path_back[id];
+        }
+    }
+    return tree;
+}
+
+void Datastructures::store_path_tree(Path_tree tree) const
+{
+    if (path_tree_index_.contains(tree.source)) {
+        return;
+    }
+    path_tree_memory_ += tree.d.size() * (sizeof(Cost) + sizeof(int));
+    path_trees_.push_front(std::move(tree));
+    path_tree_index_[path_trees_.front().source] = path_trees_.begin();
+    trim_path_trees();
+}
+
+void Datastructures::trim_path_trees() const
+{
+    while (path_tree_memory_ > path_tree_memory_limit_) {
+        const Path_tree& oldest = path_trees_.back();
+        path_tree_memory_ -= oldest.d.size() * (sizeof(Cost) + sizeof(int));
+        path_tree_index_.erase(oldest.source);
+        path_trees_.pop_back();
+    }
+}
+
+void Datastructures::repair_path_trees_added(int a, int b, Cost cost)
+{
+    //With negative costs the improvements could go around forever.
+    if (cost < 0) {
+        clear_path_trees();
+        return;
+    }
+    std::size_t n = nodes_by_id_.size();
+    for (Path_tree& tree : path_trees_) {
+        //Fibre may have added new nodes.
+        if (tree.d.size() < n) {
+            path_tree_memory_ += (n - tree.d.size()) * (sizeof(Cost) + sizeof(int));
+            tree.d.resize(n, -1);
+            tree.path_back.resize(n, -1);
+        }
+        tree.version = graph_version_;
+
+        Binary_heap Q;
+        for (auto [u, v] : {std::make_pair(a, b), std::make_pair(b, a)}) {
+            if (tree.d[u] != -1 && (tree.d[v] == -1 || tree.d[u] + cost < tree.d[v])) {
+                tree.d[v] = tree.d[u] + cost;
+                tree.path_back[v] = u;
+                Q.push(tree.d[v], v);
+            }
+        }
+        //Dijkstra over the improved nodes only.
+        while (!Q.empty()) {
+            auto [du, u] = Q.pop();
+            if (du != tree.d[u]) {
+                continue;
+            }
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                Cost c = fibre_table_[fibre].cost;
+                if (tree.d[v] == -1 || du + c < tree.d[v]) {
+                    tree.d[v] = du + c;
+                    tree.path_back[v] = u;
+                    Q.push(tree.d[v], v);
+                }
+            }
+        }
+    }
+    trim_path_trees();
+}
+
+void Datastructures::repair_path_trees_removed(int a, int b)
+{
+    for (Path_tree& tree : path_trees_) {
+        tree.version = graph_version_;
+        //Which end hangs below the fibre in the tree, if either.
+        int child = -1;
+        if (tree.path_back[b] == a) {
+            child = b;
+        } else if (tree.path_back[a] == b) {
+            child = a;
+        } else {
+            //Not a tree fibre, every tree route still exists.
+            continue;
+        }
+
+        //Collect the subtree of child and forget its d. Tree children are
+        //graph neighbours whose path_back is the node.
+        std::vector<int> subtree = {child};
+        for (std::size_t i = 0; i < subtree.size(); ++i) {
+            int u = subtree[i];
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                if (tree.path_back[v] == u) {
+                    subtree.push_back(v);
+                }
+            }
+        }
+        for (int u : subtree) {
+            tree.d[u] = -1;
+            tree.path_back[u] = -1;
+        }
+
+        //Best entry to each subtree node from outside the subtree.
+        Binary_heap Q;
+        for (int u : subtree) {
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                Cost c = fibre_table_[fibre].cost;
+                if (tree.d[v] != -1 && (tree.d[u] == -1 || tree.d[v] + c < tree.d[u])) {
+                    tree.d[u] = tree.d[v] + c;
+                    tree.path_back[u] = v;
+                }
+            }
+            if (tree.d[u] != -1) {
+                Q.push(tree.d[u], u);
+            }
+        }
+        //Dijkstra inside the subtree. Nodes outside it already have their
+        //final d, so the relax condition never changes them.
+        while (!Q.empty()) {
+            auto [du, u] = Q.pop();
+            if (du != tree.d[u]) {
+                continue;
+            }
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                Cost c = fibre_table_[fibre].cost;
+                if (tree.d[v] == -1 || du + c < tree.d[v]) {
+                    tree.d[v] = du + c;
+                    tree.path_back[v] = u;
+                    Q.push(tree.d[v], v);
+                }
+            }
+        }
+    }
+}
+
+void Datastructures::clear_path_trees()
+{
+    path_trees_.clear();
+    path_tree_index_.clear();
+    path_tree_memory_ = 0;
+}
+
+bool Datastructures::same_component(Coord xpoint1, Coord xpoint2) const
+{
+    auto lock = read_lock();
+    if (!fibres_.contains(xpoint1) || !fibres_.contains(xpoint2)) {
+        return false;
+    }
+    return connected(fibres_.at(xpoint1)->id, fibres_.at(xpoint2)->id);
+}
+
+int Datastructures::find_fibre(int u, int v) const
+{
+    const Fibre_node* node = nodes_by_id_[u].get();
+    if (nodes_by_id_[v]->fibres.size() < node->fibres.size()) {
+        node = nodes_by_id_[v].get();
+    }
+    for (int fibre : node->fibres) {
+        const Fibre& f = fibre_table_[fibre];
+        if ((f.from == u && f.to == v) || (f.from == v && f.to == u)) {
+            return fibre;
+        }
+    }
+    return -1;
+}
+
+std::pair<Coord, Coord> Datastructures::fibre_coords(int id) const
+{
+    Coord xpoint1 = nodes_by_id_[fibre_table_[id].from]->location;
+    Coord xpoint2 = nodes_by_id_[fibre_table_[id].to]->location;
+    if (xpoint2 < xpoint1) {
+        std::swap(xpoint1, xpoint2);
+    }
+    return {xpoint1, xpoint2};
+}
+
+void Datastructures::compact_fibre_order() const
+{
+    if (removed_fibre_ids_.empty()) {
+        return;
+    }
+    //Filtering keeps the sorted prefix sorted.
+    std::size_t kept = 0;
+    std::size_t kept_sorted = 0;
+    for (std::size_t i = 0; i < fibre_order_.size(); ++i) {
+        if (fibre_table_[fibre_order_[i]].from != -1) {
+            fibre_order_[kept++] = fibre_order_[i];
+            if (i < fibre_order_sorted_) {
+                kept_sorted = kept;
+            }
+        }
+    }
+    fibre_order_.resize(kept);
+    fibre_order_sorted_ = kept_sorted;
+    free_fibre_ids_.insert(free_fibre_ids_.end(), removed_fibre_ids_.begin(), removed_fibre_ids_.end());
+    removed_fibre_ids_.clear();
+}
+
+bool Datastructures::connected(int a, int b) const
+{
+    return connectivity_.connected(a, b);
+}
+
+void Datastructures::witness_cycles_added(int a, int b, int component_a, int component_b)
+{
+    int component = connectivity_.component(a);
+    if (component_a == component_b) {
+        //The fibre closed a cycle, it is the newest one so it's the witness.
+        witness_cycles_.erase(component_a);
+        witness_cycles_[component] = {a, b, {}};
+        return;
+    }
+    //Joined two components, the cycles of both stay valid. Keep one.
+    for (int old_component : {component_a, component_b}) {
+        auto it = witness_cycles_.find(old_component);
+        if (it != witness_cycles_.end()) {
+            Witness_cycle witness = std::move(it->second);
+            witness_cycles_.erase(it);
+            witness_cycles_[component] = std::move(witness);
+        }
+    }
+}
+
+void Datastructures::witness_cycles_removed(int a, int b, int component)
+{
+    auto it = witness_cycles_.find(component);
+    if (it == witness_cycles_.end()) {
+        return;
+    }
+    Witness_cycle witness = std::move(it->second);
+    witness_cycles_.erase(it);
+
+    //A witness that hasn't been built yet may not be on a cycle anymore,
+    //it is found again from connectivity_ when needed.
+    const std::vector<int>& cycle = witness.cycle;
+    if (cycle.empty()) {
+        return;
+    }
+    for (std::size_t i = 0; i < cycle.size(); ++i) {
+        int u = cycle[i];
+        int v = cycle[(i + 1) % cycle.size()];
+        if ((u == a && v == b) || (u == b && v == a)) {
+            return;
+        }
+    }
+    witness_cycles_[connectivity_.component(cycle.front())] = std::move(witness);
+}
+
+const std::vector<int>* Datastructures::witness_cycle(int s) const
+{
+    int component = connectivity_.component(s);
+    auto it = witness_cycles_.find(component);
+    if (it == witness_cycles_.end()) {
+        auto [from, to] = connectivity_.cycle_edge(s);
+        if (from == -1) {
+            return nullptr;
+        }
+        it = witness_cycles_.emplace(component, Witness_cycle{from, to, {}}).first;
+    }
+    Witness_cycle& witness = it->second;
+    if (!witness.cycle.empty()) {
+        return &witness.cycle;
+    }
+
+    //Breadth first search from to back to from without the fibre
+    //from - to itself. The route and the fibre are the shortest cycle
+    //through the fibre.
+    Search_state& S = search_;
+    S.begin(nodes_by_id_.size());
+    std::queue<int> Q = {};
+    S.touch(witness.to);
+    S.color[witness.to] = BLACK;
+    Q.push(witness.to);
+    while (!Q.empty()) {
+        int u = Q.front();
+        Q.pop();
+        if (u == witness.from) {
+            break;
+        }
+        for (int fibre : nodes_by_id_[u]->fibres) {
+            int v = fibre_table_[fibre].other(u);
+            if (u == witness.to && v == witness.from) {
+                continue;
+            }
+            S.touch(v);
+            if (S.color[v] == WHITE) {
+                S.color[v] = BLACK;
+                S.path_back[v] = u;
+                Q.push(v);
+            }
+        }
+    }
+    for (int u = witness.from; u != -1; u = S.path_back[u]) {
+        witness.cycle.push_back(u);
+    }
+    return &witness.cycle;
+}
+
+void Datastructures::fibres_changed()
+{
+    ++graph_version_;
+    landmarks_dirty_ = true;
+    ch_dirty_ = true;
+    hub_labels_dirty_ = true;
+}
+
+bool Datastructures::cached_route(const Route_key& key, std::vector<std::pair<Coord, Cost>>& route) const
+{
+    std::lock_guard cache_lock(route_cache_mutex_);
+    auto it = route_cache_index_.find(key);
+    if (it == route_cache_index_.end() || it->second->version != graph_version_) {
+        ++route_cache_misses_;
+        return false;
+    }
+    ++route_cache_hits_;
+    //Move to the front, iterators stay valid.
+    route_cache_.splice(route_cache_.begin(), route_cache_, it->second);
+    route = it->second->route;
+    return true;
+}
+
+void Datastructures::cache_route(const Route_key& key, const std::vector<std::pair<Coord, Cost>>& route) const
+{
+    std::lock_guard cache_lock(route_cache_mutex_);
+    if (route_cache_capacity_ == 0) {
+        return;
+    }
+    //Outdated entry of the same key is reused.
+    auto it = route_cache_index_.find(key);
+    if (it != route_cache_index_.end()) {
+        it->second->version = graph_version_;
+        it->second->route = route;
+        route_cache_.splice(route_cache_.begin(), route_cache_, it->second);
+        return;
+    }
+    if (route_cache_.size() >= route_cache_capacity_) {
+        route_cache_index_.erase(route_cache_.back().key);
+        route_cache_.pop_back();
+    }
+    route_cache_.push_front({key, graph_version_, route});
+    route_cache_index_.emplace(key, route_cache_.begin());
+}
+
+void Datastructures::update_landmarks() const
+{
+    if (!landmarks_dirty_) {
+        return;
+    }
+    landmarks_dirty_ = false;
+    landmark_d_.clear();
+    std::size_t n = nodes_by_id_.size();
+
+    //Start from an arbitrary node. Its farthest node becomes the first
+    //landmark, the start itself isn't one.
+    int next = -1;
+    for (std::size_t id = 0; id < n && next == -1; ++id) {
+        if (nodes_by_id_[id] != nullptr) {
+            next = id;
+        }
+    }
+    int start = next;
+
+    //closest[id] = cost from id to the closest landmark, -1 if no landmark
+    //reaches id.
+    std::vector<Cost> closest(n, -1);
+    bool is_landmark = false;
+    while (next != -1 && landmark_d_.size() < LANDMARK_COUNT) {
+        Search_state& S = search_;
+        S.begin(n);
+        with_route_queue(max_fibre_cost_, [&](auto& Q) {
+            dijkstra(S, Q, next, [](int) { return true; });
+        });
+        std::vector<Cost> dist(n, -1);
+        for (std::size_t id = 0; id < n; ++id) {
+            if (S.stamp[id] == S.epoch) {
+                dist[id] = S.d[id];
+            }
+        }
+        if (!is_landmark || landmark_d_.empty()) {
+            closest = dist;
+        } else {
+            for (std::size_t id = 0; id < n; ++id) {
+                if (dist[id] != -1 && (closest[id] == -1 || dist[id] < closest[id])) {
+                    closest[id] = dist[id];
+                }
+            }
+        }
+        if (is_landmark) {
+            landmark_d_.push_back(std::move(dist));
+        }
+
+        //Farthest node from every landmark so far. After the first landmark
+        //nodes that no landmark reaches are the farthest of all.
+        next = -1;
+        Cost farthest = 0;
+        for (std::size_t id = 0; id < n; ++id) {
+            if (nodes_by_id_[id] == nullptr) {
+                continue;
+            }
+            if (closest[id] == -1) {
+                if (!is_landmark) {
+                    continue;
+                }
+                next = id;
+                break;
+            }
+            if (closest[id] > farthest) {
+                farthest = closest[id];
+                next = id;
+            }
+        }
+        //Everything is at cost 0 from the start, use the start then.
+        if (!is_landmark && next == -1) {
+            next = start;
+        }
+        is_landmark = true;
+    }
+}
+
+void Datastructures::update_hub_labels() const
+{
+    if (!hub_labels_dirty_) {
+        return;
+    }
+    hub_labels_dirty_ = false;
+    std::size_t n = nodes_by_id_.size();
+
+    //Nodes contracted last in the contraction hierarchy are on the most
+    //routes, they are the roots first. Labels stay small that way, the
+    //fibre degree alone says nothing on grid-like networks.
+    std::vector<int> order = {};
+    {
+        std::lock_guard engine_lock(engine_mutex_);
+        update_contraction_hierarchy();
+        order.assign(ch_order_.rbegin(), ch_order_.rend());
+    }
+
+    std::vector<std::vector<std::pair<int, Cost>>> labels(n);
+    //root_cost[rank] = cost from the current root to the hub of that rank,
+    //-1 if it isn't in the root's label.
+    std::vector<Cost> root_cost(order.size(), -1);
+    using Entry = std::pair<Cost, int>;
+    for (std::size_t rank = 0; rank < order.size(); ++rank) {
+        int root = order[rank];
+        for (auto [hub, cost] : labels[root]) {
+            root_cost[hub] = cost;
+        }
+
+        //Dijkstra from root that doesn't go past nodes the labels so far
+        //already give a route as cheap for.
+        Search_state& S = search_;
+        S.begin(n);
+        std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> Q = {};
+        S.touch(root);
+        S.d[root] = 0;
+        Q.emplace(0, root);
+        while (!Q.empty()) {
+            auto [du, u] = Q.top();
+            Q.pop();
+            if (S.color[u] == BLACK) {
+                continue;
+            }
+            S.color[u] = BLACK;
+            bool covered = false;
+            for (auto [hub, cost] : labels[u]) {
+                if (root_cost[hub] != -1 && root_cost[hub] + cost <= du) {
+                    covered = true;
+                    break;
+                }
+            }
+            if (covered) {
+                continue;
+            }
+            labels[u].emplace_back(rank, du);
+            for (int fibre : nodes_by_id_[u]->fibres) {
+                int v = fibre_table_[fibre].other(u);
+                Cost dv = du + fibre_table_[fibre].cost;
+                S.touch(v);
+                if (S.color[v] != BLACK && (S.d[v] == -1 || dv < S.d[v])) {
+                    S.d[v] = dv;
+                    Q.emplace(dv, v);
+                }
+            }
+        }
+
+        for (auto [hub, cost] : labels[root]) {
+            root_cost[hub] = -1;
+        }
+    }
+
+    //Labels were filled root by root, so they are already sorted by rank.
+    hub_offset_.assign(n + 1, 0);
+    hub_ranks_.clear();
+    hub_costs_.clear();
+    for (std::size_t id = 0; id < n; ++id) {
+        for (auto [hub, cost] : labels[id]) {
+            hub_ranks_.push_back(hub);
+            hub_costs_.push_back(cost);
+        }
+        hub_offset_[id + 1] = hub_ranks_.size();
+    }
+    hub_offset_.shrink_to_fit();
+    hub_ranks_.shrink_to_fit();
+    hub_costs_.shrink_to_fit();
+}
+
+Cost Datastructures::hub_label_cost(int s, int t) const
+{
+    std::size_t i = hub_offset_[s];
+    std::size_t j = hub_offset_[t];
+    std::size_t i_end = hub_offset_[s + 1];
+    std::size_t j_end = hub_offset_[t + 1];
+    Cost const INF = std::numeric_limits<Cost>::max();
+    Cost best = INF;
+    //Merge of two sorted arrays without branches in the loop body: the
+    //side with the smaller rank advances, both on a common hub.
+    while (i < i_end && j < j_end) {
+        int a = hub_ranks_[i];
+        int b = hub_ranks_[j];
+        Cost sum = hub_costs_[i] + hub_costs_[j];
+        best = (a == b && sum < best) ? sum : best;
+        i += a <= b;
+        j += b <= a;
+    }
+    return best == INF ? NO_COST : best;
+}
+
+void Datastructures::update_contraction_hierarchy() const
+{
+    if (!ch_dirty_) {
+        return;
+    }
+    ch_dirty_ = false;
+    std::size_t n = nodes_by_id_.size();
+    ch_up_.assign(n, {});
+    ch_order_.clear();
+
+    //Working copy of the graph. Contracted nodes are removed from it.
+    std::vector<std::vector<Ch_edge>> adj(n);
+    for (std::size_t id = 0; id < n; ++id) {
+        if (nodes_by_id_[id] == nullptr) {
+            continue;
+        }
+        for (int fibre : nodes_by_id_[id]->fibres) {
+            const Fibre& f = fibre_table_[fibre];
+            adj[id].push_back({f.other(id), f.cost, -1});
+        }
+    }
+
+    Search_state W;
+    std::vector<int> contracted_neighbours(n, 0);
+    auto priority = [&](int v) {
+        int shortcuts = contract_node(adj, W, v, true);
+        return shortcuts - static_cast<int>(adj[v].size()) + contracted_neighbours[v];
+    };
+
+    //Min-heap of (priority, id).
+    std::priority_queue<std::pair<int, int>, std::vector<std::pair<int, int>>,
+                        std::greater<std::pair<int, int>>> order = {};
+    for (std::size_t id = 0; id < n; ++id) {
+        if (nodes_by_id_[id] != nullptr) {
+            order.emplace(priority(id), id);
+        }
+    }
+
+    while (!order.empty()) {
+        int v = order.top().second;
+        order.pop();
+        //Lazy update: the priority may be outdated because of earlier
+        //contractions. Put v back if it isn't the cheapest anymore.
+        int p = priority(v);
+        if (!order.empty() && p > order.top().first) {
+            order.emplace(p, v);
+            continue;
+        }
+        if (adj[v].size() > CH_MAX_DEGREE) {
+            //v and everything left becomes the core.
+            order.emplace(p, v);
+            break;
+        }
+        for (const Ch_edge& e : adj[v]) {
+            ++contracted_neighbours[e.to];
+        }
+        contract_node(adj, W, v, false);
+        //Remaining edges of v go to nodes contracted later.
+        ch_up_[v] = std::move(adj[v]);
+        adj[v].clear();
+        ch_order_.push_back(v);
+    }
+
+    //Core nodes keep all their edges to each other.
+    while (!order.empty()) {
+        int v = order.top().second;
+        order.pop();
+        ch_up_[v] = adj[v];
+        ch_order_.push_back(v);
+    }
+}
+
+int Datastructures::contract_node(std::vector<std::vector<Ch_edge>>& adj, Search_state& W,
+                                  int v, bool simulate) const
+{
+    int shortcuts = 0;
+    std::vector<Ch_edge> neighbours = adj[v];
+    Cost max_out = 0;
+    for (const Ch_edge& e : neighbours) {
+        max_out = std::max(max_out, e.cost);
+    }
+
+    for (std::size_t i = 0; i < neighbours.size(); ++i) {
+        const Ch_edge& in = neighbours[i];
+        //Witness search from in.to without v. It only has to find routes
+        //cheaper than in.cost + max_out.
+        Cost limit = in.cost + max_out;
+        W.begin(adj.size());
+        W.touch(v);
+        W.color[v] = BLACK;
+        W.touch(in.to);
+        W.color[in.to] = GRAY;
+        W.d[in.to] = 0;
+        Binary_heap Q;
+        Q.push(0, in.to);
+        int settled = 0;
+        while (!Q.empty() && settled < CH_WITNESS_LIMIT) {
+            auto [du, u] = Q.pop();
+            if (W.color[u] == BLACK || du != W.d[u]) {
+                continue;
+            }
+            if (du > limit) {
+                break;
+            }
+            W.color[u] = BLACK;
+            ++settled;
+            for (const Ch_edge& e : adj[u]) {
+                W.touch(e.to);
+                if (W.color[e.to] != BLACK && relax(W, u, e.to, e.cost)) {
+                    W.color[e.to] = GRAY;
+                    Q.push(W.d[e.to], e.to);
+                }
+            }
+        }
+
+        //Pairs are undirected, each is checked once.
+        for (std::size_t j = i + 1; j < neighbours.size(); ++j) {
+            const Ch_edge& out = neighbours[j];
+            Cost via_v = in.cost + out.cost;
+            W.touch(out.to);
+            if (W.d[out.to] != -1 && W.d[out.to] <= via_v) {
+                continue;
+            }
+            ++shortcuts;
+            if (simulate) {
+                continue;
+            }
+            //Add or improve the shortcut in both directions.
+            for (auto [a, b] : {std::make_pair(in.to, out.to), std::make_pair(out.to, in.to)}) {
+                auto it = std::find_if(adj[a].begin(), adj[a].end(),
+                                       [b](const Ch_edge& e) { return e.to == b; });
+                if (it == adj[a].end()) {
+                    adj[a].push_back({b, via_v, v});
+                } else if (via_v < it->cost) {
+                    it->cost = via_v;
+                    it->middle = v;
+                }
+            }
+        }
+    }
+
+    if (!simulate) {
+        //Remove v from the remaining graph.
+        for (const Ch_edge& e : neighbours) {
+            std::vector<Ch_edge>& list = adj[e.to];
+            list.erase(std::find_if(list.begin(), list.end(),
+                                    [v](const Ch_edge& f) { return f.to == v; }));
+        }
+    }
+    return shortcuts;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::ch_route(Search_state& F, Search_state& B, int s, int t) const
+{
+    std::size_t n = nodes_by_id_.size();
+    F.begin(n);
+    B.begin(n);
+
+    //Both searches only go upwards. A side stops when its smallest key is
+    //at least the best route found, the other one may still improve it.
+    Cost best = -1;
+    int meet = -1;
+    unsigned long long settled = 0;
+    Binary_heap QF;
+    Binary_heap QB;
+    F.touch(s);
+    F.d[s] = 0;
+    F.color[s] = GRAY;
+    QF.push(0, s);
+    B.touch(t);
+    B.d[t] = 0;
+    B.color[t] = GRAY;
+    QB.push(0, t);
+
+    while (true) {
+        bool f_open = !QF.empty() && (best == -1 || QF.min_key() < best);
+        bool b_open = !QB.empty() && (best == -1 || QB.min_key() < best);
+        if (!f_open && !b_open) {
+            break;
+        }
+        bool forward = f_open && (!b_open || QF.min_key() <= QB.min_key());
+        Search_state& A = forward ? F : B;
+        Search_state& O = forward ? B : F;
+        Binary_heap& QA = forward ? QF : QB;
+
+        auto [du, u] = QA.pop();
+        if (A.color[u] == BLACK || du != A.d[u]) {
+            continue;
+        }
+        A.color[u] = BLACK;
+        ++settled;
+        O.touch(u);
+        if (O.d[u] != -1 && (best == -1 || du + O.d[u] < best)) {
+            best = du + O.d[u];
+            meet = u;
+        }
+        for (const Ch_edge& e : ch_up_[u]) {
+            A.touch(e.to);
+            if (A.color[e.to] != BLACK && relax(A, u, e.to, e.cost)) {
+                A.color[e.to] = GRAY;
+                QA.push(A.d[e.to], e.to);
+            }
+        }
+    }
+
+    settled_count_ += settled;
+    if (best == -1) {
+        return {};
+    }
+
+    //Hierarchy route s -> meet -> t.
+    std::vector<int> hops = {};
+    for (int v = meet; v != -1; v = F.path_back[v]) {
+        hops.push_back(v);
+    }
+    std::reverse(hops.begin(), hops.end());
+    for (int v = B.path_back[meet]; v != -1; v = B.path_back[v]) {
+        hops.push_back(v);
+    }
+
+    //Edge a-b of the hierarchy is in the list of the one contracted first.
+    auto ch_edge = [this](int a, int b) {
+        for (int k = 0; k < 2; ++k) {
+            for (const Ch_edge& e : ch_up_[a]) {
+                if (e.to == b) {
+                    return e;
+                }
+            }
+            std::swap(a, b);
+        }
+        return Ch_edge{-1, NO_COST, -1};
+    };
+
+    //Unpack shortcuts with a stack of (from, to) edges. With zero-cost
+    //fibres the witness searches can tie, and the walk may come back to a
+    //node it has visited. The loop in between costs 0 because the walk is
+    //fastest, so it is cut out: position tells where each node of the
+    //route is.
+    std::vector<std::pair<Coord, Cost>> route = {};
+    std::unordered_map<int, std::size_t> position = {{s, 0}};
+    std::vector<int> route_ids = {s};
+    route.emplace_back(nodes_by_id_[s]->location, 0);
+    Cost total = 0;
+    for (std::size_t i = 1; i < hops.size(); ++i) {
+        std::vector<std::pair<int, int>> stack = {{hops[i-1], hops[i]}};
+        while (!stack.empty()) {
+            auto [a, b] = stack.back();
+            stack.pop_back();
+            Ch_edge e = ch_edge(a, b);
+            if (e.middle == -1) {
+                total += e.cost;
+                auto [it, added] = position.emplace(b, route.size());
+                if (!added) {
+                    //Back at b, drop the loop after it.
+                    for (std::size_t k = it->second + 1; k < route_ids.size(); ++k) {
+                        position.erase(route_ids[k]);
+                    }
+                    route.resize(it->second + 1);
+                    route_ids.resize(it->second + 1);
+                    continue;
+                }
+                route_ids.push_back(b);
+                route.emplace_back(nodes_by_id_[b]->location, total);
+            } else {
+                //a -> middle is unpacked first.
+                stack.emplace_back(e.middle, b);
+                stack.emplace_back(a, e.middle);
+            }
+        }
+    }
+    return route;
+}
+
+Cost Datastructures::landmark_bound(int v, int t) const
+{
+    Cost bound = 0;
+    for (const std::vector<Cost>& dist : landmark_d_) {
+        //Landmark in another component says nothing.
+        if (dist[v] == -1 || dist[t] == -1) {
+            continue;
+        }
+        bound = std::max(bound, std::abs(dist[t] - dist[v]));
+    }
+    return bound;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::route_with_costs(const std::vector<int>& path) const
+{
+    std::vector<std::pair<Coord, Cost>> route = {};
+    Cost total = 0;
+    for (std::size_t i = 0; i < path.size(); ++i) {
+        const Fibre_node& node = *nodes_by_id_[path[i]];
+        if (i > 0) {
+            total += fibre_table_[find_fibre(path[i-1], path[i])].cost;
+        }
+        route.emplace_back(node.location, total);
+    }
+    return route;
+}
+
+std::vector<std::pair<Coord, Cost>> Datastructures::build_route(const Search_state& S, int t) const
+{
+    std::vector<std::pair<Coord, Cost>> route = {};
+    //Traverse through the route backwards.
+    while (t != -1) {
+        route.emplace_back(nodes_by_id_[t]->location, S.d[t]);
+        t = S.path_back[t];
+    }
+    std::reverse(route.begin(), route.end());
+    return route;
+}
+
+std::shared_ptr<Datastructures::Fibre_node> Datastructures::get_or_add_fibre_node(Coord xy)
+{
+    auto [it, added] = fibres_.try_emplace(xy, nullptr);
+    if (!added) {
+        return it->second;
+    }
+    it->second = std::make_shared<Fibre_node>(xy);
+    //Reuse a freed id if there is one, so the id space stays dense.
+    if (!free_node_ids_.empty()) {
+        it->second->id = free_node_ids_.back();
+        free_node_ids_.pop_back();
+        nodes_by_id_[it->second->id] = it->second;
+    } else {
+        it->second->id = nodes_by_id_.size();
+        nodes_by_id_.push_back(it->second);
+    }
+    xpoint_order_.push_back(xy);
+    xpoint_grid_.insert(xy);
+    return it->second;
+}
+
+void Datastructures::erase_fibre_node(Coord xy)
+{
+    int id = fibres_.at(xy)->id;
+    //The id will be reused, so trees must forget it. The node has no
+    //fibres left, so no other node has it as path_back.
+    auto tree_it = path_tree_index_.find(id);
+    if (tree_it != path_tree_index_.end()) {
+        path_tree_memory_ -= tree_it->second->d.size() * (sizeof(Cost) + sizeof(int));
+        path_trees_.erase(tree_it->second);
+        path_tree_index_.erase(tree_it);
+    }
+    for (Path_tree& tree : path_trees_) {
+        tree.d[id] = -1;
+        tree.path_back[id] = -1;
+    }
+    nodes_by_id_[id] = nullptr;
+    free_node_ids_.push_back(id);
+    connectivity_.remove_vertex(id);
+    fibres_.erase(xy);
+    xpoints_removed_ = true;
+    xpoint_grid_.erase(xy);
+}
+
+void Datastructures::Search_state::begin(std::size_t node_count)
+{
+    //Grow the side arrays if nodes were added since the last query.
+    //New slots get stamp 0 which is never a live epoch.
+    if (stamp.size() < node_count) {
+        stamp.resize(node_count, 0);
+        d.resize(node_count, -1);
+        path_back.resize(node_count, -1);
+        color.resize(node_count, WHITE);
+    }
+    ++epoch;
+    //On wrap around old stamps could look live again, so clear them once.
+    if (epoch == 0) {
+        std::fill(stamp.begin(), stamp.end(), 0);
+        epoch = 1;
+    }
+}
+
+std::size_t Datastructures::Radix_heap::bucket_of(Cost key) const
+{
+    if (key == last_) {
+        return 0;
+    }
+    //Index of the highest differing bit + 1.
+    return 32 - std::countl_zero(static_cast<unsigned int>(key ^ last_));
+}
+
+void Datastructures::Radix_heap::refill()
+{
+    if (!buckets_[0].empty()) {
+        return;
+    }
+    assert(size_ > 0 && "Radix_heap is empty!");
+    std::size_t i = 1;
+    while (buckets_[i].empty()) {
+        ++i;
+    }
+    //The new minimum becomes last_ and every element of bucket i moves to
+    //a lower bucket because they all share the bits above bit i-1 with it.
+    last_ = std::min_element(buckets_[i].begin(), buckets_[i].end())->first;
+    for (const auto& item : buckets_[i]) {
+        buckets_[bucket_of(item.first)].push_back(item);
+    }
+    buckets_[i].clear();
+}
+
+bool Datastructures::relax(Search_state& S, int u, int v, Cost cost) const
+{
+    if (S.d[v] > S.d[u]+cost || S.d[v] == -1) {
+        S.d[v] = S.d[u]+cost;
+        S.path_back[v] = u;
+        return true;
+    }
+    return false;
+}
+
+void Datastructures::Dynamic_connectivity::add_edge(int u, int v)
+{
+    ensure_level(0);
+    Edge_info& info = edges_[edge_key(u, v)];
+    if (connected(u, v)) {
+        //Cycle, keep it as a non-tree edge of level 0.
+        nontree_[0][u].insert(v);
+        nontree_[0][v].insert(u);
+        update_nontree_flag(0, u);
+        update_nontree_flag(0, v);
+    } else {
+        info.tree = true;
+        link(0, u, v, info);
+    }
+}
+
+void Datastructures::Dynamic_connectivity::remove_edge(int u, int v)
+{
+    auto it = edges_.find(edge_key(u, v));
+    if (it == edges_.end()) {
+        return;
+    }
+    Edge_info info = std::move(it->second);
+    edges_.erase(it);
+
+    if (!info.tree) {
+        nontree_[info.level][u].erase(v);
+        nontree_[info.level][v].erase(u);
+        update_nontree_flag(info.level, u);
+        update_nontree_flag(info.level, v);
+        return;
+    }
+
+    for (int i = 0; i <= info.level; ++i) {
+        cut(info.arcs[i]);
+    }
+
+    //Look for a replacement from the highest level of the edge down.
+    for (int i = info.level; i >= 0; --i) {
+        int root_u = root_of(vertex_node(i, u));
+        int root_v = root_of(vertex_node(i, v));
+        //Search from the smaller half.
+        if (nodes_[root_u].vertices > nodes_[root_v].vertices) {
+            std::swap(root_u, root_v);
+        }
+
+        //Tree edges of level i in the smaller half go up a level. The half
+        //fits in F_i+1 because it has at most half the nodes.
+        std::vector<int> found = {};
+        collect(root_u, true, found);
+        ensure_level(i + 1);
+        for (int arc : found) {
+            int x = nodes_[arc].from;
+            int y = nodes_[arc].to;
+            nodes_[arc].own_tree = false;
+            pull_up(arc);
+            Edge_info& raised = edges_.at(edge_key(x, y));
+            raised.level = i + 1;
+            link(i + 1, x, y, raised);
+        }
+
+        //Non-tree edges of level i from the smaller half either reconnect
+        //the halves or stay inside it and go up a level.
+        found.clear();
+        collect(root_u, false, found);
+        for (int node : found) {
+            int x = nodes_[node].vertex;
+            std::vector<int> others(nontree_[i][x].begin(), nontree_[i][x].end());
+            for (int y : others) {
+                nontree_[i][x].erase(y);
+                nontree_[i][y].erase(x);
+                update_nontree_flag(i, y);
+                Edge_info& edge = edges_.at(edge_key(x, y));
+                if (root_of(vertex_node(i, y)) == root_v) {
+                    update_nontree_flag(i, x);
+                    edge.tree = true;
+                    for (int j = 0; j <= i; ++j) {
+                        link(j, x, y, edge);
+                    }
+                    return;
+                }
+                edge.level = i + 1;
+                nontree_[i + 1][x].insert(y);
+                nontree_[i + 1][y].insert(x);
+                update_nontree_flag(i + 1, x);
+                update_nontree_flag(i + 1, y);
+            }
+            update_nontree_flag(i, x);
+        }
+    }
+    //No replacement, the component was split.
+}
+
+void Datastructures::Dynamic_connectivity::remove_vertex(int u)
+{
+    for (std::size_t level = 0; level < vertex_nodes_.size(); ++level) {
+        auto it = vertex_nodes_[level].find(u);
+        if (it != vertex_nodes_[level].end()) {
+            free_node(it->second);
+            vertex_nodes_[level].erase(it);
+        }
+        nontree_[level].erase(u);
+    }
+}
+
+void Datastructures::Dynamic_connectivity::clear()
+{
+    nodes_.clear();
+    free_nodes_.clear();
+    vertex_nodes_.clear();
+    nontree_.clear();
+    edges_.clear();
+}
+
+bool Datastructures::Dynamic_connectivity::connected(int u, int v) const
+{
+    return u == v || component(u) == component(v);
+}
+
+int Datastructures::Dynamic_connectivity::component(int u) const
+{
+    if (!vertex_nodes_.empty()) {
+        auto it = vertex_nodes_[0].find(u);
+        if (it != vertex_nodes_[0].end()) {
+            return root_of(it->second);
+        }
+    }
+    //Vertex without edges, it is a component of its own. Node indices are
+    //non-negative, so this can't collide with them.
+    return -2 - u;
+}
+
+std::uint64_t Datastructures::Dynamic_connectivity::edge_key(int u, int v)
+{
+    if (u > v) {
+        std::swap(u, v);
+    }
+    return (static_cast<std::uint64_t>(u) << 32) | static_cast<unsigned int>(v);
+}
+
+int Datastructures::Dynamic_connectivity::new_node(int vertex, int from, int to)
+{
+    //xorshift for the treap priorities.
+    seed_ ^= seed_ << 13;
+    seed_ ^= seed_ >> 17;
+    seed_ ^= seed_ << 5;
+    Ett_node node;
+    node.priority = seed_;
+    node.vertex = vertex;
+    node.from = from;
+    node.to = to;
+    node.vertices = vertex != -1 ? 1 : 0;
+    if (!free_nodes_.empty()) {
+        int x = free_nodes_.back();
+        free_nodes_.pop_back();
+        nodes_[x] = node;
+        return x;
+    }
+    nodes_.push_back(node);
+    return nodes_.size() - 1;
+}
+
+void Datastructures::Dynamic_connectivity::free_node(int x)
+{
+    free_nodes_.push_back(x);
+}
+
+void Datastructures::Dynamic_connectivity::pull(int x)
+{
+    Ett_node& node = nodes_[x];
+    node.size = 1;
+    node.vertices = node.vertex != -1 ? 1 : 0;
+    node.any_tree = node.own_tree;
+    node.any_nontree = node.own_nontree;
+    node.any_cycle = node.own_cycle;
+    for (int child : {node.left, node.right}) {
+        if (child != -1) {
+            node.size += nodes_[child].size;
+            node.vertices += nodes_[child].vertices;
+            node.any_tree = node.any_tree || nodes_[child].any_tree;
+            node.any_nontree = node.any_nontree || nodes_[child].any_nontree;
+            node.any_cycle = node.any_cycle || nodes_[child].any_cycle;
+        }
+    }
+}
+
+void Datastructures::Dynamic_connectivity::pull_up(int x)
+{
+    for (; x != -1; x = nodes_[x].parent) {
+        pull(x);
+    }
+}
+
+int Datastructures::Dynamic_connectivity::merge(int a, int b)
+{
+    if (a == -1 || b == -1) {
+        int root = a != -1 ? a : b;
+        if (root != -1) {
+            nodes_[root].parent = -1;
+        }
+        return root;
+    }
+    if (nodes_[a].priority > nodes_[b].priority) {
+        int right = merge(nodes_[a].right, b);
+        nodes_[a].right = right;
+        nodes_[right].parent = a;
+        nodes_[a].parent = -1;
+        pull(a);
+        return a;
+    }
+    int left = merge(a, nodes_[b].left);
+    nodes_[b].left = left;
+    nodes_[left].parent = b;
+    nodes_[b].parent = -1;
+    pull(b);
+    return b;
+}
+
+std::pair<int, int> Datastructures::Dynamic_connectivity::cycle_edge(int u) const
+{
+    if (vertex_nodes_.empty()) {
+        return {-1, -1};
+    }
+    auto it = vertex_nodes_[0].find(u);
+    if (it == vertex_nodes_[0].end()) {
+        return {-1, -1};
+    }
+    int x = root_of(it->second);
+    if (!nodes_[x].any_cycle) {
+        return {-1, -1};
+    }
+    //Walk down to a marked vertex.
+    while (!nodes_[x].own_cycle) {
+        int left = nodes_[x].left;
+        x = left != -1 && nodes_[left].any_cycle ? left : nodes_[x].right;
+    }
+    int v = nodes_[x].vertex;
+    for (const auto& level : nontree_) {
+        auto edges = level.find(v);
+        if (edges != level.end() && !edges->second.empty()) {
+            return {v, *edges->second.begin()};
+        }
+    }
+    return {-1, -1};
+}
+
+std::pair<int, int> Datastructures::Dynamic_connectivity::split(int t, int k)
+{
+    //First k nodes of the tour and the rest.
+    if (t == -1) {
+        return {-1, -1};
+    }
+    int left = nodes_[t].left;
+    int left_size = left != -1 ? nodes_[left].size : 0;
+    if (k <= left_size) {
+        auto [a, b] = split(left, k);
+        nodes_[t].left = b;
+        if (b != -1) {
+            nodes_[b].parent = t;
+        }
+        if (a != -1) {
+            nodes_[a].parent = -1;
+        }
+        nodes_[t].parent = -1;
+        pull(t);
+        return {a, t};
+    }
+    auto [a, b] = split(nodes_[t].right, k - left_size - 1);
+    nodes_[t].right = a;
+    if (a != -1) {
+        nodes_[a].parent = t;
+    }
+    if (b != -1) {
+        nodes_[b].parent = -1;
+    }
+    nodes_[t].parent = -1;
+    pull(t);
+    return {t, b};
+}
+
+int Datastructures::Dynamic_connectivity::root_of(int x) const
+{
+    while (nodes_[x].parent != -1) {
+        x = nodes_[x].parent;
+    }
+    return x;
+}
+
+int Datastructures::Dynamic_connectivity::index_of(int x) const
+{
+    int left = nodes_[x].left;
+    int index = left != -1 ? nodes_[left].size : 0;
+    while (nodes_[x].parent != -1) {
+        int parent = nodes_[x].parent;
+        if (nodes_[parent].right == x) {
+            int parent_left = nodes_[parent].left;
+            index += 1 + (parent_left != -1 ? nodes_[parent_left].size : 0);
+        }
+        x = parent;
+    }
+    return index;
+}
+
+int Datastructures::Dynamic_connectivity::reroot(int x)
+{
+    //The tour is cyclic, rotate it to start from x.
+    int root = root_of(x);
+    auto [before, from_x] = split(root, index_of(x));
+    return merge(from_x, before);
+}
+
+void Datastructures::Dynamic_connectivity::ensure_level(int level)
+{
+    if (static_cast<int>(vertex_nodes_.size()) <= level) {
+        vertex_nodes_.resize(level + 1);
+        nontree_.resize(level + 1);
+    }
+}
+
+int Datastructures::Dynamic_connectivity::vertex_node(int level, int v)
+{
+    auto [it, added] = vertex_nodes_[level].try_emplace(v, -1);
+    if (added) {
+        it->second = new_node(v, -1, -1);
+    }
+    return it->second;
+}
+
+void Datastructures::Dynamic_connectivity::link(int level, int u, int v, Edge_info& info)
+{
+    int tour_u = reroot(vertex_node(level, u));
+    int tour_v = reroot(vertex_node(level, v));
+    //tour_u, u -> v, tour_v, v -> u
+    int arc_uv = new_node(-1, u, v);
+    int arc_vu = new_node(-1, v, u);
+    if (level == info.level) {
+        nodes_[arc_uv].own_tree = true;
+        pull(arc_uv);
+    }
+    merge(merge(merge(tour_u, arc_uv), tour_v), arc_vu);
+    if (static_cast<int>(info.arcs.size()) <= level) {
+        info.arcs.resize(level + 1);
+    }
+    info.arcs[level] = {arc_uv, arc_vu};
+}
+
+void Datastructures::Dynamic_connectivity::cut(std::pair<int, int> arcs)
+{
+    //Tour is A, arc, B, arc, C where B is the tour of one half and A, C of
+    //the other one.
+    auto [first, second] = arcs;
+    int root = root_of(first);
+    int index_first = index_of(first);
+    int index_second = index_of(second);
+    if (index_first > index_second) {
+        std::swap(index_first, index_second);
+    }
+    auto [a, rest] = split(root, index_first);
+    auto [arc1, rest2] = split(rest, 1);
+    auto [tour_b, rest3] = split(rest2, index_second - index_first - 1);
+    auto [arc2, c] = split(rest3, 1);
+    merge(a, c);
+    free_node(arc1);
+    free_node(arc2);
+}
+
+void Datastructures::Dynamic_connectivity::update_nontree_flag(int level, int v)
+{
+    auto it = nontree_[level].find(v);
+    bool has_edges = it != nontree_[level].end() && !it->second.empty();
+    if (!has_edges && it != nontree_[level].end()) {
+        nontree_[level].erase(it);
+    }
+    int node = vertex_node(level, v);
+    if (nodes_[node].own_nontree != has_edges) {
+        nodes_[node].own_nontree = has_edges;
+        pull_up(node);
+    }
+    update_cycle_flag(v);
+}
+
+void Datastructures::Dynamic_connectivity::update_cycle_flag(int v)
+{
+    bool has_edges = false;
+    for (const auto& level : nontree_) {
+        if (level.contains(v)) {
+            has_edges = true;
+            break;
+        }
+    }
+    int node = vertex_node(0, v);
+    if (nodes_[node].own_cycle != has_edges) {
+        nodes_[node].own_cycle = has_edges;
+        pull_up(node);
+    }
+}
+
+void Datastructures::Dynamic_connectivity::collect(int root, bool tree, std::vector<int>& found) const
+{
+    std::vector<int> stack = {root};
+    while (!stack.empty()) {
+        int x = stack.back();
+        stack.pop_back();
+        if (x == -1 || !(tree ? nodes_[x].any_tree : nodes_[x].any_nontree)) {
+            continue;
+        }
+        if (tree ? nodes_[x].own_tree : nodes_[x].own_nontree) {
+            found.push_back(x);
+        }
+        stack.push_back(nodes_[x].left);
+        stack.push_back(nodes_[x].right);
+    }
+}
+
+void Datastructures::Spatial_grid::insert(Coord xy)
+{
+    ++size_;
+    Coord c = cell_of(xy);
+    cells_[c].push_back(xy);
+    if (max_cell_.x < min_cell_.x) {
+        min_cell_ = c;
+        max_cell_ = c;
+    }
+    min_cell_ = {std::min(min_cell_.x, c.x), std::min(min_cell_.y, c.y)};
+    max_cell_ = {std::max(max_cell_.x, c.x), std::max(max_cell_.y, c.y)};
+    if (size_ > 2 * rebuild_size_) {
+        rebuild();
+    }
+}
+
+void Datastructures::Spatial_grid::erase(Coord xy)
+{
+    auto it = cells_.find(cell_of(xy));
+    if (it == cells_.end()) {
+        return;
+    }
+    std::vector<Coord>& xpoints = it->second;
+    auto found = std::find(xpoints.begin(), xpoints.end(), xy);
+    if (found == xpoints.end()) {
+        return;
+    }
+    *found = xpoints.back();
+    xpoints.pop_back();
+    if (xpoints.empty()) {
+        cells_.erase(it);
+    }
+    --size_;
+    if (size_ < rebuild_size_ / 4) {
+        rebuild();
+    }
+}
+
+void Datastructures::Spatial_grid::clear()
+{
+    *this = Spatial_grid();
+}
+
+Coord Datastructures::Spatial_grid::nearest(Coord xy) const
+{
+    if (size_ == 0) {
+        return NO_COORD;
+    }
+    Coord best = NO_COORD;
+    Wide best_d = {};
+    auto consider = [&](const std::vector<Coord>& xpoints) {
+        for (Coord c : xpoints) {
+            Wide d = squared_distance(c, xy);
+            if (best == NO_COORD || d < best_d || (d == best_d && c < best)) {
+                best_d = d;
+                best = c;
+            }
+        }
+    };
+
+    //Rings of cells around the cell of xy. Rings before start don't touch
+    //the bounding box, after end every cell has been searched.
+    Coord c = cell_of(xy);
+    long long start = std::max({0LL, static_cast<long long>(min_cell_.x) - c.x,
+                                static_cast<long long>(c.x) - max_cell_.x,
+                                static_cast<long long>(min_cell_.y) - c.y,
+                                static_cast<long long>(c.y) - max_cell_.y});
+    long long end = std::max({std::abs(static_cast<long long>(c.x) - min_cell_.x),
+                              std::abs(static_cast<long long>(c.x) - max_cell_.x),
+                              std::abs(static_cast<long long>(c.y) - min_cell_.y),
+                              std::abs(static_cast<long long>(c.y) - max_cell_.y)});
+    //Too sparse around xy if more cells than xpoints would be searched,
+    //then checking every xpoint is cheaper.
+    std::size_t budget = 2 * size_ + 16;
+    std::size_t visited = 0;
+    auto visit = [&](long long x, long long y) {
+        ++visited;
+        auto it = cells_.find({static_cast<int>(x), static_cast<int>(y)});
+        if (it != cells_.end()) {
+            consider(it->second);
+        }
+        return visited <= budget;
+    };
+    bool in_budget = true;
+    for (long long k = start; k <= end && in_budget; ++k) {
+        //Everything in ring k is at least (k-1) cells away along one axis.
+        long long gap = (k - 1) * cell_size_;
+        if (best != NO_COORD && k > 0 && best_d <= square(gap)) {
+            return best;
+        }
+        //Top and bottom rows of the ring, then the sides between them,
+        //clipped to the bounding box. Each ring from start to end has a
+        //cell in the box.
+        long long x0 = std::max<long long>(c.x - k, min_cell_.x);
+        long long x1 = std::min<long long>(c.x + k, max_cell_.x);
+        for (long long y : {c.y - k, c.y + k}) {
+            if ((k == 0 && y != c.y - k) || y < min_cell_.y || y > max_cell_.y) {
+                continue;
+            }
+            for (long long x = x0; x <= x1 && in_budget; ++x) {
+                in_budget = visit(x, y);
+            }
+        }
+        long long y0 = std::max<long long>(c.y - k + 1, min_cell_.y);
+        long long y1 = std::min<long long>(c.y + k - 1, max_cell_.y);
+        for (long long x : {c.x - k, c.x + k}) {
+            if (k == 0 || x < min_cell_.x || x > max_cell_.x) {
+                continue;
+            }
+            for (long long y = y0; y <= y1 && in_budget; ++y) {
+                in_budget = visit(x, y);
+            }
+        }
+    }
+    if (!in_budget) {
+        best = NO_COORD;
+        for (const auto& [cell, xpoints] : cells_) {
+            consider(xpoints);
+        }
+    }
+    return best;
+}
+
+Datastructures::Spatial_grid::Wide Datastructures::Spatial_grid::square(unsigned long long v)
+{
+    //Schoolbook multiplication in 32 bit halves.
+    unsigned long long high = v >> 32;
+    unsigned long long low = v & 0xffffffffULL;
+    unsigned long long middle = 2 * high * low; //v < 2^34, can't overflow
+    unsigned long long result_low = low * low;
+    unsigned long long result_high = high * high + (middle >> 32);
+    unsigned long long shifted = middle << 32;
+    result_low += shifted;
+    if (result_low < shifted) {
+        ++result_high;
+    }
+    return {result_high, result_low};
+}
+
+Datastructures::Spatial_grid::Wide Datastructures::Spatial_grid::squared_distance(Coord a, Coord b)
+{
+    //Differences of ints fit in 33 bits, their squares in 64.
+    unsigned long long dx = std::abs(static_cast<long long>(a.x) - b.x);
+    unsigned long long dy = std::abs(static_cast<long long>(a.y) - b.y);
+    unsigned long long low = dx * dx + dy * dy;
+    return {low < dx * dx ? 1 : 0, low};
+}
+
+Coord Datastructures::Spatial_grid::cell_of(Coord xy) const
+{
+    auto floor_div = [this](int v) {
+        long long q = v / cell_size_;
+        if (v % cell_size_ != 0 && v < 0) {
+            --q;
+        }
+        return static_cast<int>(q);
+    };
+    return {floor_div(xy.x), floor_div(xy.y)};
+}
+
+void Datastructures::Spatial_grid::rebuild()
+{
+    std::vector<Coord> xpoints = {};
+    xpoints.reserve(size_);
+    for (const auto& [cell, in_cell] : cells_) {
+        xpoints.insert(xpoints.end(), in_cell.begin(), in_cell.end());
+    }
+    cells_.clear();
+    rebuild_size_ = size_;
+    min_cell_ = {0, 0};
+    max_cell_ = {-1, -1};
+    if (xpoints.empty()) {
+        cell_size_ = 1;
+        return;
+    }
+
+    //About two xpoints per cell over the bounding box.
+    long long min_x = xpoints.front().x;
+    long long max_x = min_x;
+    long long min_y = xpoints.front().y;
+    long long max_y = min_y;
+    for (Coord xy : xpoints) {
+        min_x = std::min<long long>(min_x, xy.x);
+        max_x = std::max<long long>(max_x, xy.x);
+        min_y = std::min<long long>(min_y, xy.y);
+        max_y = std::max<long long>(max_y, xy.y);
+    }
+    double area = static_cast<double>(max_x - min_x + 1) * static_cast<double>(max_y - min_y + 1);
+    double size = std::ceil(std::sqrt(2.0 * area / xpoints.size()));
+    cell_size_ = static_cast<int>(std::clamp(size, 1.0, static_cast<double>(std::numeric_limits<int>::max())));
+
+    size_ = 0;
+    for (Coord xy : xpoints) {
+        //insert would rebuild again, rebuild_size_ is already size_.
+        ++size_;
+        Coord c = cell_of(xy);
+        cells_[c].push_back(xy);
+        if (max_cell_.x < min_cell_.x) {
+            min_cell_ = c;
+            max_cell_ = c;
+        }
+        min_cell_ = {std::min(min_cell_.x, c.x), std::min(min_cell_.y, c.y)};
+        max_cell_ = {std::max(max_cell_.x, c.x), std::max(max_cell_.y, c.y)};
+    }
+}
+
+/*std::shared_ptr<Datastructures::Fibre_node> Datastructures::dfs_recursive(std::shared_ptr<Fibre_node> s)
+{
+    s->color = GRAY;
+    for (const auto& [coord, cost] : s->edges) {
+        std::shared_ptr<Fibre_node> v = fibres_.at(coord);
+        if (v->color == WHITE) {
+            v->path_back = s;
+            v = dfs_recursive(v);
+            if (v->color == BLACK) {
+                return v;
+            }
+        }
+        if (s->path_back != v && v->color == GRAY) {
+            v->color = BLACK;
+            return s;
+        }
+    }
+    return nullptr;
+}*/
@@ -12,6 +12,17 @@
 #include <map>
 #include <set>
 #include <memory>
+#include <array>
+#include <queue>
+#include <functional>
+#include <list>
+#include <span>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+#include <cstdint>
+#include <cassert>
 
 // Type for beacon IDs
 using BeaconID = std::string;
@@ -138,7 +149,7 @@ public:
     // Estimate of performance: W/A/B(1)
     // Short rationale for estimate:
     //unordered_map.size() is constant.
-    int beacon_count();
+    int beacon_count() const;
 
     // Estimate of performance: W/A/B(n) in the size of beacon_map_.
     // Short rationale for estimate:
@@ -149,7 +160,7 @@ public:
     // Estimate of performance: W/A/B(n) in the size of beacon_map_.
     // Short rationale for estimate:
     //A for loop through all the elements in beacon_map_ is linear in its size.
-    std::vector<BeaconID> all_beacons();
+    std::vector<BeaconID> all_beacons() const;
 
     // Estimate of performance: W(n) in the size of beacon_map_. A/B(1).
     // Short rationale for estimate:
@@ -158,34 +169,34 @@ public:
     //unordered_map.at() is constant on average, worst case linear in size of the
     //container. -> W = n + n, A/B = 1 + 1.
     //We get W = n and A/B = 1.
-    Name get_name(BeaconID id);
+    Name get_name(BeaconID id) const;
 
     // Estimate of performance: W(n) in the size of beacon_map_. A/B(1).
     // Short rationale for estimate: Same as in get_name.
-    Coord get_coordinates(BeaconID id);
+    Coord get_coordinates(BeaconID id) const;
 
     // Estimate of performance: W(n) in the size of beacon_map_. A/B(1).
     // Short rationale for estimate: Same as in get_name.
-    Color get_color(BeaconID id);
+    Color get_color(BeaconID id) const;
 
     // We recommend you implement the operations below only after implementing the ones above
 
     // Estimate of performance: W/A/B(n) in the size of name_map_.
     // Short rationale for estimate: A for loop through all the elements
     //in name_map_ is linear in its size.
-    std::vector<BeaconID> beacons_alphabetically();
+    std::vector<BeaconID> beacons_alphabetically() const;
 
     // Estimate of performance: W/A/B(n) in the size of brightness_map_.
     // Short rationale for estimate: Same as in beacons_alphabetically.
-    std::vector<BeaconID> beacons_brightness_increasing();
+    std::vector<BeaconID> beacons_brightness_increasing() const;
 
     // Estimate of performance: W/A/B(1).
     // Short rationale for estimate: Everything is constant.
-    BeaconID min_brightness();
+    BeaconID min_brightness() const;
 
     // Estimate of performance: W/A/B(1).
     // Short rationale for estimate: Everything is constant.
-    BeaconID max_brightness();
+    BeaconID max_brightness() const;
 
     // Estimate of performance: W(n log n) in the size of name_map_.
     // B(log n) in the size of name_map_.
@@ -201,7 +212,7 @@ public:
     //has 1 element.
     // -> W = log n + n + n*log n, B = log n + 1 + 1.
     // -> W = n*log n, B = log n.
-    std::vector<BeaconID> find_beacons(Name const& name);
+    std::vector<BeaconID> find_beacons(Name const& name) const;
 
     // Estimate of performance: W(n), B(log n) both in the size of beacon_map_.
     // Short rationale for estimate:
@@ -237,7 +248,7 @@ public:
     //worst case it has to loop through beacon_map_.size()-1 iterations.
     //Best case zero iterations.
     // -> W = n + n, B = 1 + 1. We get W = n, B = 1.
-    std::vector<BeaconID> get_lightsources(BeaconID id);
+    std::vector<BeaconID> get_lightsources(BeaconID id) const;
 
     // Estimate of performance: W(n) in the size of beacon_map_. B(1).
     // Short rationale for estimate:
@@ -245,7 +256,7 @@ public:
     // -> W = 2*n, B = 2.
     //Worst case every beacon is in the linked list. Best case no outbeam is sent.
     // -> W = 2*n + n, B = 2 + 1. We get W = n, B = 1.
-    std::vector<BeaconID> path_outbeam(BeaconID id);
+    std::vector<BeaconID> path_outbeam(BeaconID id) const;
 
     // B operations
 
@@ -254,56 +265,58 @@ public:
     //undoreder_map.contains() worst case linear, average case constant.
     //get_longest_inbeam_route() W(n), B(1).
     // -> W = n, B(1).
-    std::vector<BeaconID> path_inbeam_longest(BeaconID id);
+    std::vector<BeaconID> path_inbeam_longest(BeaconID id) const;
 
     // Estimate of performance: W(n) in the size of beacon_map_. B(1).
     // Short rationale for estimate:
     //.contains() worst case linear, average case constant
     //get_total_color() worst case linear, best case constant.
-    Color total_color(BeaconID id);
+    Color total_color(BeaconID id) const;
 
-    // Estimate of performance: W(n) in fibers_.size().
-    // B(log m+s) in m=edges.size() and s=unique_fibres_.size()? Maybe.
+    // Estimate of performance: W(n) in fibers_.size(), A(m) in the degree
+    // m of the ends plus the connectivity and cache updates.
     // Short rationale for estimate:
     //.try_emplace()/.at() worst case linear in fibers_.size(), average case constant.
-    //map.contains()/emplace() logarithmic in Fiber_node->edges.size().
-    //When function returns true and n = fibers_size(), m = edges.size().
-    // -> W = 4n + 3 log m, B = 4 + 3 log m.
-    //set.emplace() logarithmic in unique_fibres_.size()
-    // -> W = 4n + 3 log m + log s, B = 4 + 3 log m + log s,
-    //where s = unique_fibres_.size().
-    // -> W = n, B = log m+s?.
+    //find_fibre scans the fibre ids of the smaller end, linear in m.
+    //The fibre goes to the end of fibre_table_ (or a free slot) and its id
+    //to both ends and to the end of fibre_order_, amortized constant.
     bool add_fibre(Coord xpoint1, Coord xpoint2, Cost cost);
 
-    // Estimate of performance: W/A/B(n log n) in size of fibers_.size().
+    // Estimate of performance: W(n + a log a), B(n) where n = fibers_.size()
+    // and a = xpoints added since the last call.
     // Short rationale for estimate:
-    //For loop is linear in fibers_.size().
-    //std::sort n log n in fibers_.size().
-    std::vector<Coord> all_xpoints();
+    //xpoint_order_ stays sorted between calls, only the xpoints added
+    //after the previous call are sorted and merged in. Removed xpoints are
+    //dropped in the same linear pass. Copying the result is linear.
+    std::vector<Coord> all_xpoints() const;
 
-    // Estimate of performance: W(n+m), B(m).
+    // Estimate of performance: W(n + m log m), B(m log m).
     // Short rationale for estimate:
     //.contains() W(n), B(1).
-    //for loop linear in edges.size().
-    // If n = fibres_.size() and m = edges.size().
-    // -> W = n + m, B = 1 + m.
-    std::vector<std::pair<Coord, Cost>> get_fibres_from(Coord xpoint);
+    //The fibres of the node are collected from fibre_table_ and sorted by
+    //coordinate, m = fibres at the node.
+    std::vector<std::pair<Coord, Cost>> get_fibres_from(Coord xpoint) const;
 
-    // Estimate of performance: W/A/B(n)
+    // Estimate of performance: W(n + a log a), B(n) where n = fibres and a =
+    // fibres added since the last call.
     // Short rationale for estimate:
-    //For loop linear in unique_fibres_.size().
-    std::vector<std::pair<Coord, Coord>> all_fibres();
+    //fibre_order_ is kept sorted lazily: only the fibres added after the
+    //previous call are sorted and merged in, removed ones are dropped in
+    //the same linear pass. Copying the result is linear.
+    std::vector<std::pair<Coord, Coord>> all_fibres() const;
 
-    // Estimate of performance: W(n) fibres_.size(), B(log n) unique_fibres_.size().
+    // Estimate of performance: W(n) fibres_.size(), A(m) in the degree of
+    // the ends plus the connectivity and cache updates.
     // Short rationale for estimate:
     //unordered.contain() W(n), A(1).
-    //set.erase() W/A/B(log n).
-    //Rest average constant, worst linear.
+    //find_fibre gives the fibre id, its slot in fibre_table_ is marked
+    //removed and the id is erased from the fibre lists of both ends, linear
+    //in their degree. fibre_order_ is compacted lazily, amortized constant.
     bool remove_fibre(Coord xpoint1, Coord xpoint2);
 
-    // Estimate of performance: W/A/B(n) where n=fibres.size()+unique_fibres.size().
+    // Estimate of performance: W/A/B(n) where n = fibres_.size() + fibres.
     // Short rationale for estimate:
-    //both .clear() linear in container size.
+    //all .clear() calls linear in container size.
     void clear_fibres();
 
     // We recommend you implement the operations below only after implementing the ones above
@@ -311,42 +324,303 @@ public:
     // Estimate of performance: W(s + k) where s = nodes, k = edges.
     // Short rationale for estimate:
     //unordered.contains() W(n), A/B(1).
-    //reset_fibre_graph_state W/A/B(n) in fibres_.size().
+    //Search_state.begin() is amortized constant, only nodes the BFS reaches
+    //are touched.
     //If s = node, k = edge. Then BFS is W(s+k).
     //Worst case route goes through all nodes. and the final while loop is
     //W(n) and std::reverse is W(2/n). We get
     //W = s + k? because s + k > n??
-    std::vector<std::pair<Coord, Cost>> route_any(Coord fromxpoint, Coord toxpoint);
+    std::vector<std::pair<Coord, Cost>> route_any(Coord fromxpoint, Coord toxpoint) const;
 
     // C operations
 
-    // Estimate of performance: Same as in route_any. W(s + k).
+    // Estimate of performance: W(s + k) where s = nodes, k = edges.
+    // Short rationale for estimate:
+    //Bidirectional BFS. Search_state.begin() amortized constant.
+    //Every node and edge is handled at most once per direction, and the
+    //search stops at the first level where the frontiers meet. The smaller
+    //frontier is always expanded, so on wide graphs it explores about
+    //2*b^(h/2) nodes instead of b^h (b = branching, h = hops).
+    //Building the route is linear in its length.
+    //A repeated query with no fibre changes in between is a route cache hit,
+    //W/A/B(1) + copying the route.
+    std::vector<std::pair<Coord, Cost>> route_least_xpoints(Coord fromxpoint, Coord toxpoint) const;
+
+    // Estimate of performance: W = k + s*C or W = k + s log C
+    // Short rationale for estimate:
+    //Search_state.begin() amortized constant, nodes are reset when reached.
+    //Dijkstras algorithm where s = nodes, k = edges and C = largest cost.
+    //With Bucket_queue (C <= MAX_BUCKET_QUEUE_COST) W(k + s*C),
+    //with Radix_heap W(k + s log C). Stale queue entries are skipped.
+    //Both engines stop early, so s and k are only the explored part of the
+    //graph: the ball around fromxpoint (DIJKSTRA) or two balls of about half
+    //the radius around both ends (BIDIRECTIONAL).
+    //A repeated query with no fibre changes in between is a route cache hit,
+    //W/A/B(1) + copying the route.
+    //From a source with a cached shortest path tree the route is a walk up
+    //the tree, W(route length).
+    //Last while loop is linear in the route length in the worst case.
+    //std::reverse worst case W(s/2).
+    std::vector<std::pair<Coord, Cost>> route_fastest(Coord fromxpoint, Coord toxpoint) const;
+
+    // Estimate of performance: W(k + s), B(log n)
     // Short rationale for estimate:
-    std::vector<std::pair<Coord, Cost>> route_least_xpoints(Coord fromxpoint, Coord toxpoint);
+    //Dynamic_connectivity tells in W(log n) if the component has a cycle at
+    //all, so acyclic components return right away. Otherwise the cycle of
+    //the component is cached (witness_cycles_) and only the BFS from start
+    //to the closest node of the cycle is done, W(k + s) with s = nodes and
+    //k = edges when the cycle is far, a few nodes when start is near it.
+    //Building the witness the first time is one more BFS, W(k + s).
+    std::vector<Coord> route_fibre_cycle(Coord startxpoint) const;
+
+    // Additional operations
+
+    //Search algorithms route_fastest can use.
+    //DIJKSTRA grows one frontier from fromxpoint until toxpoint is settled.
+    //BIDIRECTIONAL grows frontiers from both ends and stops when they meet.
+    //ALT is A* towards toxpoint with landmark distances as the heuristic.
+    //CH searches upwards from both ends in a contraction hierarchy.
+    enum class Route_engine { DIJKSTRA, BIDIRECTIONAL, ALT, CH };
+
+    // Estimate of performance: W(c + t), B(1)
+    // Short rationale for estimate:
+    //Switching to another engine drops the c cached routes and t cached
+    //path trees, so the new engine does its own searches. Setting the same
+    //engine again only stores the value.
+    void set_route_engine(Route_engine engine);
+
+    // Estimate of performance: W/A/B(1)
+    // Short rationale for estimate: Only returns the value.
+    Route_engine route_engine() const;
 
-    // Estimate of performance: W = (n+k+s)log(s+k)
+    // Estimate of performance: W/A/B(1)
+    // Short rationale for estimate: Only returns the counter.
+    //Number of nodes route_fastest has settled since the last reset, path
+    //tree builds included. Used for comparing the route engines.
+    unsigned long long settled_count() const;
+
+    // Estimate of performance: W/A/B(1)
+    // Short rationale for estimate: Only resets the counter.
+    void reset_settled_count();
+
+    // Estimate of performance: W(log n) expected, n = fibres_.size().
     // Short rationale for estimate:
-    //reset_graph_state() W/A/B(n) in fibres_.size().
-    //Dijkstras algorithm W((s + k)log (s + k)) where s = nodes, k = edges.
-    //Last while loop is linear in ~fibres_.size() in the worst case.
-    //std::reset worst case W(n/2) in fibres_.size().
-    //W = (n+k+s)log(s+k)
-    std::vector<std::pair<Coord, Cost>> route_fastest(Coord fromxpoint, Coord toxpoint);
+    //Dynamic_connectivity is updated by add_fibre and remove_fibre, the
+    //query only compares the roots of two Euler tour treaps.
+    //Returns true if there is a route between the xpoints.
+    bool same_component(Coord xpoint1, Coord xpoint2) const;
 
-    // Estimate of performance: W(n + k + s)
+    // Estimate of performance: W(k + s log C + t) where s = nodes, k = edges,
+    // C = largest cost and t = toxpoints.size().
+    // Short rationale for estimate:
+    //One Dijkstra from fromxpoint that stops when every target is settled,
+    //so s and k are the ball up to the farthest target. Checking if a
+    //settled node is a target is constant on average.
+    //Returns the cost of the fastest route to every toxpoint in the same
+    //order, NO_COST if there is no route. Routes aren't built, route_fastest
+    //gives the route of a pair when it is needed.
+    std::vector<Cost> route_costs(Coord fromxpoint, std::vector<Coord> const& toxpoints) const;
+
+    // Estimate of performance: W(f * (k + s log C + t) / p) where f =
+    // fromxpoints.size() and p = number of hardware threads.
     // Short rationale for estimate:
-    //reset_fibre_graph_state W/A/B(n) in fibres_.size().
-    //first while loop is linear in the amount of nodes in the worst case.
-    //for loop is linear in the amount of edges in the graph. So dfs algo is
-    //So if n = fibres_.size(), s = nodes, k = edges. W = n + k + s.
-    //Last while loop is linear in ~fibres_.size() in the worst case.
-    //std::reset worst case W(n/2) in fibres_.size().
-    //W = 2n + k + s. W = n + k + s.
-    std::vector<Coord> route_fibre_cycle(Coord startxpoint);
+    //Same search as route_costs for every fromxpoint. The searches are
+    //independent, so they are spread over the hardware threads, each with
+    //its own search state. result[i][j] is the cost from fromxpoints[i] to
+    //toxpoints[j].
+    std::vector<std::vector<Cost>> route_cost_matrix(std::vector<Coord> const& fromxpoints,
+                                                     std::vector<Coord> const& toxpoints) const;
+
+    // Estimate of performance: W((n + k) * r / p + n log n) where r = rounds
+    // per bucket and p = number of hardware threads.
+    // Short rationale for estimate:
+    //Delta-stepping: nodes are kept in buckets of width delta by their
+    //cost. A bucket is emptied by relaxing the light fibres of its nodes
+    //over the hardware threads in rounds, then the heavy fibres once. Costs
+    //are atomics lowered with compare and swap, so the threads don't need
+    //locks. With negative costs a plain Dijkstra is run instead. The sorted
+    //xpoints come from all_xpoints.
+    //Returns every xpoint in coordinate order with the cost of the fastest
+    //route from fromxpoint to it, NO_COST if there is none. Empty if
+    //fromxpoint isn't an xpoint.
+    std::vector<std::pair<Coord, Cost>> route_costs_all(Coord fromxpoint) const;
+
+    // Estimate of performance: W(l), l = length of the hub labels of the
+    // xpoints, usually small. First call after fibres change builds the labels.
+    // Short rationale for estimate:
+    //Pruned landmark labeling. Every node has a label of (hub, cost) pairs
+    //sorted by hub, and every fastest route goes through a hub that is in
+    //the labels of both ends, so the cost is the cheapest sum over the
+    //common hubs. The labels are merged like sorted arrays, branch free.
+    //With negative costs the labels don't work and a Dijkstra is run.
+    //Returns the cost of route_fastest(fromxpoint, toxpoint), NO_COST if
+    //there is no route.
+    Cost route_cost(Coord fromxpoint, Coord toxpoint) const;
+
+    // Estimate of performance: W(r log C + k), r = xpoints within budget,
+    // k = their fibres.
+    // Short rationale for estimate:
+    //Dijkstra from fromxpoint that stops at the first node over the
+    //budget. The epoch-stamped search state is only touched for the nodes
+    //reached, so nothing is proportional to the whole network. With
+    //negative costs the search can't stop early and goes through the
+    //component.
+    //Returns the xpoints reachable with at most budget and their costs,
+    //cheapest first, ties in coordinate order. Empty if fromxpoint isn't
+    //an xpoint or budget < 0.
+    std::vector<std::pair<Coord, Cost>> xpoints_within_cost(Coord fromxpoint, Cost budget) const;
+
+    // Estimate of performance: W(r log C + k), r = xpoints cheaper than the
+    // nearest beacon, k = their fibres.
+    // Short rationale for estimate:
+    //One Dijkstra from xpoint. beacons_at_ tells in O(1) on average if a
+    //settled xpoint has a beacon, and the search stops after the nodes
+    //with the cost of the first one found. With negative costs the search
+    //goes through the whole component.
+    //Returns the beacon at the xpoint reachable from xpoint with the
+    //smallest fibre cost, the smallest id on ties. NO_BEACON if xpoint
+    //isn't an xpoint or no beacon is reachable.
+    BeaconID nearest_beacon_by_fibre(Coord xpoint) const;
+
+    // Estimate of performance: W(1), or building the labels if the fibres
+    // have changed.
+    // Short rationale for estimate: Sizes of the three label arrays.
+    //Returns the bytes taken by the hub labels of route_cost.
+    std::size_t hub_label_memory() const;
+
+    // Estimate of performance: W(q * route_fastest / p) where q =
+    // queries.size() and p = number of hardware threads.
+    // Short rationale for estimate:
+    //Queries found in the route cache are answered first. The others are
+    //spread over the hardware threads, each with its own search states, and
+    //only read the graph, so they don't wait for each other. Landmarks or
+    //the contraction hierarchy are prepared once before the threads start.
+    //result[i] is route_fastest(queries[i].first, queries[i].second).
+    std::vector<std::vector<std::pair<Coord, Cost>>> route_fastest_batch(
+        std::span<const std::pair<Coord, Coord>> queries) const;
+
+    // Estimate of performance: W(q * route_least_xpoints / p)
+    // Short rationale for estimate:
+    //Same as route_fastest_batch with the bidirectional BFS of
+    //route_least_xpoints.
+    std::vector<std::vector<std::pair<Coord, Cost>>> route_least_xpoints_batch(
+        std::span<const std::pair<Coord, Coord>> queries) const;
+
+    // Estimate of performance: W(k + s log C), B(log n)
+    // Short rationale for estimate:
+    //Dynamic_connectivity answers components without cycles in W(log n).
+    //Otherwise one Dijkstra from startxpoint, every node remembers the
+    //first fibre of its route. A fibre between two settled nodes with
+    //different first fibres closes a cycle through startxpoint, and the
+    //search stops when no cheaper one can be found anymore.
+    //Returns the cheapest cycle startxpoint ... startxpoint with the costs
+    //from the start, empty if there is none.
+    std::vector<std::pair<Coord, Cost>> route_shortest_cycle(Coord startxpoint) const;
+
+    // Estimate of performance: W(s * (k + s log C)), B(k + s)
+    // Short rationale for estimate:
+    //route_shortest_cycle's search from every node that is in a component
+    //with cycles. Each search stops when it can't beat the best cycle
+    //found so far, so once a short cycle is known the searches only
+    //look at small balls around their start.
+    //Returns the cost of the cheapest cycle in the network, NO_COST if
+    //there are no cycles.
+    Cost girth() const;
+
+    // Estimate of performance: W(k log k + s), k = fibres, s = nodes.
+    // Short rationale for estimate:
+    //Kruskal: the fibres are collected as (cost, node id, node id) and
+    //sorted, then a union-find with path halving and union by size takes
+    //every fibre that joins two different trees, practically constant per
+    //fibre. The sort dominates.
+    //Returns the fibres of a minimum spanning forest, cheapest first, with
+    //pair.first < pair.second like all_fibres, and their total cost. Every
+    //component of the network stays connected with these fibres alone.
+    std::pair<std::vector<std::pair<Coord, Coord>>, Cost> minimum_spanning_backbone() const;
+
+    // Estimate of performance: W(k * l * (m + n log C)), l = length of the
+    // routes, n = nodes, m = fibres.
+    // Short rationale for estimate:
+    //Yen's algorithm. One Dijkstra from toxpoint gives the fastest route
+    //and the exact cost to toxpoint from every node. Every next route is
+    //the cheapest of the spur candidates: for each node of the previous
+    //route a search from it to toxpoint with the route so far and the
+    //fibres taken by earlier routes banned. The bans are masks over node
+    //and fibre ids, and the spur searches are A* with the costs to
+    //toxpoint as the heuristic, which stays a lower bound with bans, so
+    //they mostly walk straight to toxpoint.
+    //Returns up to k loopless routes from cheapest, each with the costs
+    //from fromxpoint like route_fastest.
+    std::vector<std::vector<std::pair<Coord, Cost>>> route_k_fastest(Coord fromxpoint, Coord toxpoint,
+                                                                     unsigned int k) const;
+
+    // Estimate of performance: A(1) for queries near the xpoints, W(n).
+    // Short rationale for estimate:
+    //xpoint_grid_ has about two xpoints per cell. The cells are searched
+    //in growing rings around xy until no unsearched cell can be closer
+    //than the best xpoint found. If that would take more cells than there
+    //are xpoints, all xpoints are checked instead, W(n).
+    //Returns the xpoint closest to xy (euclidean), the smaller coord on
+    //ties, NO_COORD if there are no xpoints.
+    Coord nearest_xpoint(Coord xy) const;
+
+    // Estimate of performance: W(c + r log r), c = cells overlapping the
+    // rectangle (at most n), r = result size.
+    // Short rationale for estimate:
+    //Only the cells overlapping the rectangle are read, then the result is
+    //sorted.
+    //Returns the xpoints with min.x <= x <= max.x and min.y <= y <= max.y
+    //in coordinate order.
+    std::vector<Coord> xpoints_in_rect(Coord min, Coord max) const;
+
+    // Estimate of performance: W(c + r log r), c = cells overlapping the
+    // bounding box of the circle (at most n), r = result size.
+    // Short rationale for estimate:
+    //Same as xpoints_in_rect for the bounding box, filtered by distance.
+    //Returns the xpoints at euclidean distance <= radius from xy in
+    //coordinate order.
+    std::vector<Coord> xpoints_within_radius(Coord xy, int radius) const;
+
+    // Estimate of performance: W/A/B(1)
+    // Short rationale for estimate: Only returns the counter.
+    //Number of route_fastest and route_least_xpoints calls answered from
+    //the route cache.
+    unsigned long long route_cache_hits() const;
+
+    // Estimate of performance: W/A/B(1)
+    // Short rationale for estimate: Only returns the counter.
+    //Number of route_fastest and route_least_xpoints calls that had to search.
+    unsigned long long route_cache_misses() const;
+
+    // Estimate of performance: W(n) in the amount of cached routes, B(1).
+    // Short rationale for estimate:
+    //Shrinking the cache evicts the least recently used routes one by one.
+    //Capacity 0 turns the cache off.
+    void set_route_cache_capacity(std::size_t capacity);
+
+    // Estimate of performance: W(t) in the amount of cached trees, B(1).
+    // Short rationale for estimate:
+    //Lowering the limit evicts the least recently used trees one by one.
+    //Sets how many bytes the cached shortest path trees may take, 0 turns
+    //them off.
+    void set_path_tree_memory_limit(std::size_t bytes);
 
 private:
     // Explain below your rationale for choosing the data structures you use in this class.
 
+    //Readers/writer lock of the whole object. Queries hold it shared and the
+    //functions that change beacons, fibres or settings hold it exclusively,
+    //so any number of queries can run at the same time, but never during a
+    //change. Data that queries fill in lazily has its own mutex next to it.
+    //Public functions take the lock, private ones expect it to be held.
+    mutable std::shared_mutex mutex_;
+    //Taken before mutex_ by readers and writers alike. std::shared_mutex
+    //may let new readers in while a writer waits, this keeps them in order.
+    mutable std::mutex write_turn_;
+
+    //Shared lock of mutex_ for queries and exclusive lock for changes.
+    std::shared_lock<std::shared_mutex> read_lock() const;
+    std::unique_lock<std::shared_mutex> write_lock();
 
     /* Struct that represents a single beacon.
      * First 4 fields should be self explanatory.
@@ -394,44 +668,486 @@ private:
     //Additionally max/min_brightness methods are fast by using map.end()/begin().
     Beacon_brightness_map brightness_map_;
 
+    //Ids of the beacons at every coord that has beacons. Lets the fibre
+    //searches check in O(1) on average if a settled xpoint has a beacon.
+    std::unordered_map<Coord, std::set<BeaconID>, CoordHash> beacons_at_;
+
 
     //Used for graph algorithms.
     enum State { WHITE, GRAY, BLACK };
 
+    //A fibre between the nodes with ids from and to. Stored once in
+    //fibre_table_, its index there is the fibre id. from == -1 for a slot
+    //of a removed fibre.
+    struct Fibre {
+        int from = -1;
+        int to = -1;
+        Cost cost = 0;
+
+        //The end of the fibre that isn't u.
+        int other(int u) const { return from == u ? to : from; }
+    };
+
     //Represents existing fiber endpoints and their connections to other
     //endpoints as a weighted undirected graph.
-    //edges could be read as to_neighbours.
+    //fibres holds the ids of the fibres at this node.
+    //id is a dense index into nodes_by_id_ and into the arrays of
+    //Search_state. Search state is no longer stored in the node itself.
     struct Fibre_node {
         Coord location;
-        std::map<Coord, Cost> edges;
+        std::vector<int> fibres;
+        int id = -1;
+    };
+
+    //Search state of a single graph query, kept in side arrays indexed by
+    //Fibre_node::id. A slot is valid only if its stamp equals epoch, so
+    //starting a new query is constant time (bump the epoch) instead of a
+    //pass over every node. touch() lazily resets a stale slot to
+    //color=WHITE, d=infinity, pi=NIL the first time a query reaches it.
+    struct Search_state {
+        std::vector<unsigned int> stamp;
+        std::vector<Cost> d;
+        std::vector<int> path_back;
+        std::vector<State> color;
+        unsigned int epoch = 0;
+
+        void begin(std::size_t node_count);
+
+        void touch(int id)
+        {
+            if (stamp[id] != epoch) {
+                stamp[id] = epoch;
+                d[id] = -1; //infinity
+                path_back[id] = -1; //NIL
+                color[id] = WHITE;
+            }
+        }
+    };
 
-        //Necessary for graph algorithms.
-        int d = -1; //infinity
-        std::shared_ptr<Fibre_node> path_back = nullptr; //pi
-        State color = WHITE;
+    //Monotone priority queues for Dijkstra. All of them have the same
+    //interface so the search can be written once as a template:
+    //push(key, id), pop() -> (key, id) with the smallest key, min_key()
+    //and empty(). Keys pushed must not be smaller than the last popped key,
+    //which holds for Dijkstra when costs are non-negative.
+
+    //Dial's algorithm. Keys in the queue always lie in [cursor, cursor+C]
+    //where C is the largest fibre cost, so C+1 buckets used as a ring are
+    //enough. O(1) push, pop is amortized O(1) + the scan over empty buckets,
+    //O(m + n*C) for a whole search.
+    class Bucket_queue {
+    public:
+        explicit Bucket_queue(Cost max_cost) : buckets_(max_cost+1) {}
+
+        void push(Cost key, int id)
+        {
+            if (cursor_ < 0) {
+                cursor_ = key;
+            }
+            buckets_[key % buckets_.size()].push_back(id);
+            ++size_;
+        }
+        std::pair<Cost, int> pop()
+        {
+            advance();
+            std::vector<int>& bucket = buckets_[cursor_ % buckets_.size()];
+            int id = bucket.back();
+            bucket.pop_back();
+            --size_;
+            return {cursor_, id};
+        }
+        Cost min_key() { advance(); return cursor_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        void advance()
+        {
+            //Every bucket would be scanned forever.
+            assert(size_ > 0 && "Bucket_queue is empty!");
+            while (buckets_[cursor_ % buckets_.size()].empty()) {
+                ++cursor_;
+            }
+        }
+
+        std::vector<std::vector<int>> buckets_;
+        Cost cursor_ = -1;
+        std::size_t size_ = 0;
     };
 
-    struct Cmp_fibre_ptrs {
-        bool operator()(const std::shared_ptr<Fibre_node> lhs,
-                        const std::shared_ptr<Fibre_node> rhs) const
+    //Radix heap. Bucket i holds keys whose highest bit differing from the
+    //last popped key is bit i-1, bucket 0 holds keys equal to it. An element
+    //can only move to lower buckets, so it moves at most 32 times.
+    //O(m + n log C) for a whole search.
+    class Radix_heap {
+    public:
+        void push(Cost key, int id)
         {
-            return lhs->d < rhs->d;
+            buckets_[bucket_of(key)].emplace_back(key, id);
+            ++size_;
         }
+        std::pair<Cost, int> pop()
+        {
+            refill();
+            std::pair<Cost, int> top = buckets_[0].back();
+            buckets_[0].pop_back();
+            --size_;
+            return top;
+        }
+        Cost min_key() { refill(); return last_; }
+        bool empty() const { return size_ == 0; }
+
+    private:
+        std::size_t bucket_of(Cost key) const;
+        void refill();
+
+        std::array<std::vector<std::pair<Cost, int>>, 33> buckets_;
+        Cost last_ = 0;
+        std::size_t size_ = 0;
     };
 
-    using Fibre_nodes = std::unordered_map<Coord, std::shared_ptr<Fibre_node>, CoordHash>;
+    //Plain binary heap. Used when some fibre has a negative cost and the
+    //monotone queues can't be used.
+    class Binary_heap {
+    public:
+        void push(Cost key, int id) { heap_.emplace(key, id); }
+        std::pair<Cost, int> pop()
+        {
+            std::pair<Cost, int> top = heap_.top();
+            heap_.pop();
+            return top;
+        }
+        Cost min_key() { return heap_.top().first; }
+        bool empty() const { return heap_.empty(); }
+
+    private:
+        std::priority_queue<std::pair<Cost, int>, std::vector<std::pair<Cost, int>>,
+                            std::greater<std::pair<Cost, int>>> heap_;
+    };
 
-    using Unique_fibres = std::set<std::pair<Coord, Coord>>;
+    //Largest fibre cost for which Bucket_queue is used instead of Radix_heap.
+    static Cost const MAX_BUCKET_QUEUE_COST = 4096;
+
+    using Fibre_nodes = std::unordered_map<Coord, std::shared_ptr<Fibre_node>, CoordHash>;
 
 
     //Data structure used for storing necessary information about fibers.
     //Weighted undirected graph.
     Fibre_nodes fibres_;
 
+    //Every fibre once, indexed by fibre id. Ids of removed fibres go to
+    //removed_fibre_ids_ and from there to free_fibre_ids_ for reuse once
+    //fibre_order_ no longer refers to them.
+    std::vector<Fibre> fibre_table_;
+    mutable std::vector<int> free_fibre_ids_;
+    mutable std::vector<int> removed_fibre_ids_;
+    std::size_t fibre_count_ = 0;
+
+    //Fibre ids for all_fibres. The first fibre_order_sorted_ are sorted by
+    //their end coords, newer fibres are appended after them and merged in
+    //when all_fibres is called. Ids of removed fibres are left in place
+    //until the order is compacted.
+    mutable std::vector<int> fibre_order_;
+    mutable std::size_t fibre_order_sorted_ = 0;
+
+    //Coords of the nodes for all_xpoints, kept like fibre_order_: the first
+    //xpoint_order_sorted_ are sorted, new nodes are appended. Removed
+    //nodes stay until the next all_xpoints if xpoints_removed_ is set.
+    mutable std::vector<Coord> xpoint_order_;
+    mutable std::size_t xpoint_order_sorted_ = 0;
+    mutable bool xpoints_removed_ = false;
+
+    //Held by all_xpoints and all_fibres while they merge the orders.
+    mutable std::mutex order_mutex_;
+
+    //Fibre nodes by their id. Ids of removed nodes are put to free_node_ids_
+    //and reused, so the side arrays of Search_state stay as dense as fibres_.
+    std::vector<std::shared_ptr<Fibre_node>> nodes_by_id_;
+    std::vector<int> free_node_ids_;
+
+    //Fully dynamic connectivity of Holm, de Lichtenberg and Thorup over
+    //node ids. Every edge has a level, the tree edges of level >= i form the
+    //spanning forest F_i and F_0 spans the whole graph. Every forest is kept
+    //as Euler tours in treaps, so connectivity is a root comparison.
+    //Deleting a tree edge searches for a replacement from the smaller half
+    //and raises the levels of the edges it looks at, so each edge is looked
+    //at most log n times.
+    //Amortized W(log^2 n) per update, W(log n) per query.
+    class Dynamic_connectivity {
+    public:
+        void add_edge(int u, int v);
+        void remove_edge(int u, int v);
+        //u must not have edges anymore.
+        void remove_vertex(int u);
+        void clear();
+
+        bool connected(int u, int v) const;
+        //Some non-tree edge in the component of u, both ends of it are on a
+        //cycle. {-1, -1} if the component is a tree. W(log n).
+        std::pair<int, int> cycle_edge(int u) const;
+        //Id of the component of u, same for every node of it until the
+        //next change. Only reads, so it is safe to call from many threads.
+        int component(int u) const;
+
+    private:
+        //Node of an Euler tour treap. Either a vertex (vertex != -1, once
+        //per vertex per level) or an arc from -> to of a tree edge.
+        //own_tree marks one arc of every tree edge whose level equals the
+        //level of this forest, own_nontree a vertex with non-tree edges of
+        //this level. any_* are the same ORed over the subtree, so the
+        //marked nodes of a tree are found without visiting the others.
+        struct Ett_node {
+            int left = -1;
+            int right = -1;
+            int parent = -1;
+            unsigned int priority = 0;
+            int vertex = -1;
+            int from = -1;
+            int to = -1;
+            int size = 1;
+            int vertices = 0;
+            bool own_tree = false;
+            bool own_nontree = false;
+            bool any_tree = false;
+            bool any_nontree = false;
+            //Only for vertex nodes of F_0: vertex has non-tree edges of
+            //any level, so the component of it has a cycle.
+            bool own_cycle = false;
+            bool any_cycle = false;
+        };
+
+        //Level of an edge, whether it is a tree edge and the two arcs of
+        //a tree edge in F_0 ... F_level.
+        struct Edge_info {
+            int level = 0;
+            bool tree = false;
+            std::vector<std::pair<int, int>> arcs;
+        };
+
+        static std::uint64_t edge_key(int u, int v);
+        int new_node(int vertex, int from, int to);
+        void free_node(int x);
+        void pull(int x);
+        void pull_up(int x);
+        int merge(int a, int b);
+        std::pair<int, int> split(int t, int k);
+        int root_of(int x) const;
+        int index_of(int x) const;
+        int reroot(int x);
+        void ensure_level(int level);
+        int vertex_node(int level, int v);
+        void link(int level, int u, int v, Edge_info& info);
+        void cut(std::pair<int, int> arcs);
+        void update_nontree_flag(int level, int v);
+        void update_cycle_flag(int v);
+        void collect(int root, bool tree, std::vector<int>& found) const;
+
+        std::vector<Ett_node> nodes_;
+        std::vector<int> free_nodes_;
+        //[level] vertex -> its vertex node in F_level.
+        std::vector<std::unordered_map<int, int>> vertex_nodes_;
+        //[level] vertex -> other ends of its non-tree edges of that level.
+        std::vector<std::unordered_map<int, std::unordered_set<int>>> nontree_;
+        std::unordered_map<std::uint64_t, Edge_info> edges_;
+        unsigned int seed_ = 2463534242u;
+    };
+
+    //Route queries use it to answer unreachable pairs without searching.
+    Dynamic_connectivity connectivity_;
+
+    //Uniform grid over the xpoints. Cell size is picked on rebuild so that
+    //there are about two xpoints per cell over their bounding box, and the
+    //grid is rebuilt when the amount of xpoints has doubled or dropped to a
+    //quarter, so updates are amortized A(1).
+    class Spatial_grid {
+    public:
+        void insert(Coord xy);
+        void erase(Coord xy);
+        void clear();
+
+        //NO_COORD if the grid is empty.
+        Coord nearest(Coord xy) const;
+
+        //Squared distances between int coords need 65 bits, so they are
+        //kept as (high, low) words that compare correctly as pairs.
+        using Wide = std::pair<unsigned long long, unsigned long long>;
+        static Wide square(unsigned long long v);
+        static Wide squared_distance(Coord a, Coord b);
+        //Unsorted. Coords with keep(xy) == true in the rectangle.
+        template <typename Keep>
+        std::vector<Coord> in_rect(Coord min, Coord max, Keep keep) const;
+
+    private:
+        //Cell of xy. Floor division so negative coords work too.
+        Coord cell_of(Coord xy) const;
+        void rebuild();
+
+        int cell_size_ = 1;
+        std::size_t size_ = 0;
+        std::size_t rebuild_size_ = 0;
+        //Bounding box of the cells with xpoints, only grows between rebuilds.
+        Coord min_cell_ = {0, 0};
+        Coord max_cell_ = {-1, -1};
+        //Cell -> xpoints in it, empty cells are erased.
+        std::unordered_map<Coord, std::vector<Coord>, CoordHash> cells_;
+    };
+
+    //Index of fibres_ keys for the coordinate queries.
+    Spatial_grid xpoint_grid_;
+
+    //Cycle of a component, closed by the fibre from -> to. cycle is the
+    //node ids from ... to, empty until route_fibre_cycle first needs it.
+    struct Witness_cycle {
+        int from;
+        int to;
+        std::vector<int> cycle;
+    };
+
+    //component -> its witness cycle. Kept up to date by add_fibre and
+    //remove_fibre, a fibre that closes a cycle becomes the witness of its
+    //component and a removed fibre drops the witness only if it was on it.
+    mutable std::unordered_map<int, Witness_cycle> witness_cycles_;
+    //Held by route_fibre_cycle while it builds or copies a witness cycle.
+    mutable std::mutex witness_mutex_;
+
+    //Scratch state of the route queries. search_back_ is the state of the
+    //backward frontier in bidirectional searches. Every thread has its own,
+    //so queries running at the same time don't share them.
+    static thread_local Search_state search_;
+    static thread_local Search_state search_back_;
+
+    //Used by route_fastest.
+    Route_engine route_engine_ = Route_engine::BIDIRECTIONAL;
+    mutable std::atomic<unsigned long long> settled_count_ = 0;
+
+    //ALT landmark tables. landmark_d_[i][id] is the cost from landmark i to
+    //the node id, -1 if it can't be reached. Computed lazily on the first
+    //ALT query after the fibres have changed.
+    mutable std::vector<std::vector<Cost>> landmark_d_;
+    mutable bool landmarks_dirty_ = true;
+
+    //How many landmarks are picked.
+    static std::size_t const LANDMARK_COUNT = 8;
+
+    //Key of the route cache.
+    enum class Route_kind { FASTEST, LEAST_XPOINTS };
+    struct Route_key {
+        Route_kind kind;
+        Coord from;
+        Coord to;
+        bool operator==(const Route_key& other) const
+        {
+            return kind == other.kind && from == other.from && to == other.to;
+        }
+    };
+    struct Route_key_hash {
+        std::size_t operator()(const Route_key& key) const
+        {
+            CoordHash hasher;
+            std::size_t h = hasher(key.from);
+            h ^= hasher(key.to) + 0x9e3779b9 + (h << 6) + (h >> 2);
+            return h ^ static_cast<std::size_t>(key.kind);
+        }
+    };
+
+    //Cached route and the graph_version_ it was computed for.
+    struct Cached_route {
+        Route_key key;
+        unsigned long long version;
+        std::vector<std::pair<Coord, Cost>> route;
+    };
 
-    //Used by all_fibres. Adds memory overhead, but massively simplifies getting
-    //Unique fibres.
-    Unique_fibres unique_fibres_;
+    //LRU cache of routes. route_cache_ is ordered from the most recently
+    //used to the least recently used, route_cache_index_ finds an entry in
+    //it by key. Entries of an older graph_version_ are misses and get
+    //replaced, so changing the fibres invalidates everything in O(1).
+    mutable std::list<Cached_route> route_cache_;
+    mutable std::unordered_map<Route_key, std::list<Cached_route>::iterator, Route_key_hash> route_cache_index_;
+    std::size_t route_cache_capacity_ = 1024;
+    mutable unsigned long long route_cache_hits_ = 0;
+    mutable unsigned long long route_cache_misses_ = 0;
+    //Held by queries while they look up or store routes and read the counters.
+    mutable std::mutex route_cache_mutex_;
+
+    //Bumped by every change to the fibres.
+    unsigned long long graph_version_ = 0;
+
+    //Complete shortest path tree from source, for the graph_version_ it was
+    //built for. d and path_back are indexed by node id like in Search_state,
+    //d is -1 for nodes the source can't reach.
+    struct Path_tree {
+        int source;
+        unsigned long long version;
+        std::vector<Cost> d;
+        std::vector<int> path_back;
+    };
+
+    //Shortest path trees of recently used sources in LRU order (most recent
+    //first) and their index by source id. route_fastest builds a tree for a
+    //source when it has been the source of PATH_TREE_THRESHOLD queries since
+    //the last fibre change. After that every route from it is just a walk up
+    //path_back. Trees take at most path_tree_memory_limit_ bytes in total.
+    //add_fibre and remove_fibre repair the trees instead of dropping them.
+    mutable std::list<Path_tree> path_trees_;
+    mutable std::unordered_map<int, std::list<Path_tree>::iterator> path_tree_index_;
+    mutable std::size_t path_tree_memory_ = 0;
+    std::size_t path_tree_memory_limit_ = 64 * 1024 * 1024;
+    mutable std::unordered_map<int, int> source_query_counts_;
+    mutable unsigned long long source_counts_version_ = 0;
+    //Held by queries while they look up or store a tree and read it, a tree
+    //can be evicted by another query otherwise. Not held while a tree is
+    //being built.
+    mutable std::mutex path_tree_mutex_;
+    static int const PATH_TREE_THRESHOLD = 4;
+
+    //Edge of the contraction hierarchy. middle is the node that was
+    //contracted when this shortcut was added, -1 for original fibres.
+    struct Ch_edge {
+        int to;
+        Cost cost;
+        int middle;
+    };
+
+    //ch_up_[id] has the edges from id to nodes contracted after it. Nodes
+    //left in the core (see CH_MAX_DEGREE) have all their core neighbours
+    //here. The graph is undirected, so the same edges are used for the
+    //forward and the backward search. Rebuilt lazily like landmark_d_.
+    mutable std::vector<std::vector<Ch_edge>> ch_up_;
+    //Node ids in the order they were contracted, the core last. Hub labels
+    //use it as the importance of the nodes.
+    mutable std::vector<int> ch_order_;
+    mutable bool ch_dirty_ = true;
+
+    //Held by prepare_route_engine while it updates landmark_d_ or ch_up_.
+    //Both only change on the first query after a change to the fibres, the
+    //searches read them without the lock after that.
+    mutable std::mutex engine_mutex_;
+
+    //Hub labels of route_cost in one array for all nodes. The label of node
+    //id is hub_ranks_[hub_offset_[id] ... hub_offset_[id+1]) sorted by
+    //rank, hub_costs_ has the costs to the hubs at the same indices. Rank 0
+    //is the node contracted last in the contraction hierarchy. Rebuilt
+    //lazily like landmark_d_.
+    mutable std::vector<std::size_t> hub_offset_;
+    mutable std::vector<int> hub_ranks_;
+    mutable std::vector<Cost> hub_costs_;
+    mutable bool hub_labels_dirty_ = true;
+    //Held by route_cost while it updates the labels.
+    mutable std::mutex hub_label_mutex_;
+
+    //Contraction stops when the cheapest node to contract has more
+    //neighbours than this. Contracting dense nodes would add a quadratic
+    //number of shortcuts, so they are left in a core that the query
+    //searches like plain Dijkstra.
+    static std::size_t const CH_MAX_DEGREE = 64;
+
+    //Witness searches give up after settling this many nodes and add the
+    //shortcut. Extra shortcuts are harmless, they only cost memory.
+    static int const CH_WITNESS_LIMIT = 100;
+
+    //Smallest and largest fibre cost ever added since the last clear_fibres.
+    //Removing fibres doesn't shrink the range, it only needs to be a bound.
+    //Used for picking the priority queue of Dijkstra.
+    Cost min_fibre_cost_ = 0;
+    Cost max_fibre_cost_ = 0;
 
 
     // Add stuff needed for your class implementation below
@@ -455,9 +1171,236 @@ private:
 
     Color get_total_color(BeaconID id) const;
 
-    void reset_fibre_graph_state();
-
-    bool relax(std::shared_ptr<Fibre_node> u, std::shared_ptr<Fibre_node> v);
+    //Returns the node at xy, creating it (and giving it an id) if needed.
+    std::shared_ptr<Fibre_node> get_or_add_fibre_node(Coord xy);
+
+    //Removes the node at xy and frees its id.
+    void erase_fibre_node(Coord xy);
+
+    //Id of the fibre between nodes u and v, -1 if there is none.
+    //Linear in the degree of the smaller end.
+    int find_fibre(int u, int v) const;
+
+    //Ends of fibre id as coords, first < second.
+    std::pair<Coord, Coord> fibre_coords(int id) const;
+
+    //Drops removed fibres from fibre_order_ and frees their ids. Linear in
+    //fibre_order_.size().
+    void compact_fibre_order() const;
+
+    //Relaxes edge u-v of weight cost in S. Returns true if d[v] improved.
+    bool relax(Search_state& S, int u, int v, Cost cost) const;
+
+    //Constructs the cheapest priority queue that is correct for the current
+    //fibre costs and calls search(queue) with it.
+    //Bucket_queue if costs are small, Radix_heap if they are large and
+    //Binary_heap if there are negative costs.
+    template <typename Search>
+    void with_route_queue(Cost max_key_step, Search search) const;
+
+    //Dijkstras algorithm from s using Q. S must be fresh (S.begin() called).
+    //settled(u) is called when u becomes BLACK, the search stops if it
+    //returns false. Stale queue entries are skipped, not re-expanded.
+    //Only reads the graph, so it can run in many threads with their own S.
+    template <typename Queue, typename Settled>
+    void dijkstra(Search_state& S, Queue& Q, int s, Settled settled) const;
+
+    //Bidirectional Dijkstra between s and t. Forward state goes to S, backward
+    //state to Sb. Stops when min key of Q + min key of Qb >= best known
+    //route cost. Returns the route, empty if t can't be reached.
+    template <typename Queue>
+    std::vector<std::pair<Coord, Cost>> bidirectional_dijkstra(Search_state& S, Queue& Q,
+                                                               Search_state& Sb, Queue& Qb,
+                                                               int s, int t) const;
+
+    //A* from s to t, where the key of a node is d + landmark_bound(v, t).
+    //Keys are monotone because the bound is consistent.
+    template <typename Queue>
+    void alt_search(Search_state& S, Queue& Q, int s, int t) const;
+
+    //A* from s to t for route_k_fastest, key of a node is d + to_t[v] where
+    //to_t is the exact cost to t without bans (-1 if t can't be reached).
+    //Nodes with node_banned set and fibres with fibre_banned set are
+    //skipped.
+    template <typename Queue>
+    void spur_search(Search_state& S, Queue& Q, int s, int t, const std::vector<Cost>& to_t,
+                     const std::vector<char>& node_banned, const std::vector<char>& fibre_banned) const;
+
+    //Recomputes landmark_d_ if the fibres have changed.
+    //Landmarks are picked farthest first: the next landmark is the node
+    //farthest from all the previous ones (unreachable nodes first, so other
+    //components get landmarks too). Each one costs one full Dijkstra.
+    // Estimate of performance: W(L * (k + s log C)) where L = LANDMARK_COUNT.
+    void update_landmarks() const;
+
+    //Rebuilds ch_up_ if the fibres have changed. Nodes are contracted in the
+    //order of their edge difference (shortcuts added - edges removed +
+    //contracted neighbours), priorities are updated lazily when popped.
+    // Estimate of performance: depends heavily on the graph, about
+    //W(s log s * d^2 * CH_WITNESS_LIMIT) where d is the degree at contraction.
+    void update_contraction_hierarchy() const;
+
+    //Contracts v from adj, or only counts the shortcuts it would need if
+    //simulate is true. adj has the edges between uncontracted nodes.
+    //W is the witness search state.
+    int contract_node(std::vector<std::vector<Ch_edge>>& adj, Search_state& W, int v, bool simulate) const;
+
+    //Upward search from both s and t in ch_up_ and unpacking of the shortcuts
+    //of the best route found. F and B are the states of the two searches.
+    std::vector<std::pair<Coord, Cost>> ch_route(Search_state& F, Search_state& B, int s, int t) const;
+
+    //Rebuilds the hub labels if the fibres have changed. Costs must be
+    //non-negative and hub_label_mutex_ held.
+    void update_hub_labels() const;
+
+    //Cost between nodes s and t from their hub labels, NO_COST if they have
+    //no common hub.
+    Cost hub_label_cost(int s, int t) const;
+
+    //Lower bound for the cost between v and t from the triangle inequality:
+    //max over landmarks L of |d(L, t) - d(L, v)|. W(L).
+    Cost landmark_bound(int v, int t) const;
+
+    //Checks if node ids a and b are in the same component.
+    bool connected(int a, int b) const;
+
+    //Moves the witnesses of the components of a and b to the joined
+    //component after the fibre a - b was added, or makes the fibre the new
+    //witness if it closed a cycle.
+    void witness_cycles_added(int a, int b, int component_a, int component_b);
+
+    //Drops the witness of component if the removed fibre a - b was on it,
+    //otherwise moves it to the component it is in now.
+    void witness_cycles_removed(int a, int b, int component);
+
+    //Cycle of the component of node s, building it with a BFS if needed.
+    //nullptr if the component has no cycles.
+    const std::vector<int>* witness_cycle(int s) const;
+
+    //Cost of the cheapest cycle through node s, -1 if there is none cheaper
+    //than bound (-1 is no bound). The cycle is s -> u, u - w, w -> s along
+    //the path_back of search_. label is scratch space for the first node
+    //after s on the route of every node, it must have nodes_by_id_.size()
+    //slots.
+    Cost shortest_cycle_through(int s, Cost bound, std::vector<int>& label, int& u, int& w) const;
+
+    //Costs from node s to every node id by parallel delta-stepping, NO_COST
+    //for nodes it can't reach. Costs must be non-negative.
+    std::vector<Cost> delta_stepping(int s) const;
+
+    //Nodes in one job of delta_stepping's parallel rounds. Rounds with at
+    //most this many nodes are run in the calling thread.
+    static std::size_t const DELTA_CHUNK = 1024;
+
+    //Merges the new xpoints into the sorted part of xpoint_order_ and drops
+    //removed ones. order_mutex_ must be held.
+    void sort_xpoint_order() const;
+
+    //Costs from node s to target_ids (-1 if not a node) using S.
+    //Used by route_costs and route_cost_matrix.
+    std::vector<Cost> costs_from(Search_state& S, int s, const std::vector<int>& target_ids) const;
+
+    //The path tree functions except build_path_tree need path_tree_mutex_.
+
+    //Returns the valid shortest path tree of s and marks it most recently
+    //used, or nullptr if s has no tree.
+    const Path_tree* find_path_tree(int s) const;
+
+    //Counts a route_fastest query from s. Returns true if s has now been
+    //used often enough as a source and the caller should build its tree.
+    bool claim_path_tree(int s) const;
+
+    //Shortest path tree of s with a full Dijkstra. Only reads the graph, so
+    //it runs without path_tree_mutex_.
+    Path_tree build_path_tree(int s) const;
+
+    //Adds a tree built by build_path_tree unless another query already
+    //added one for the same source.
+    void store_path_tree(Path_tree tree) const;
+
+    //Evicts least recently used trees until they fit the memory limit.
+    void trim_path_trees() const;
+
+    //Repairs the cached trees after fibre a-b was added. If the fibre gives
+    //a or b a cheaper route, a Dijkstra starting from that endpoint visits
+    //only the nodes whose d improves.
+    // Estimate of performance: W(t * (a log a + k_a)) where t = cached trees,
+    // a = improved nodes and k_a = their edges.
+    void repair_path_trees_added(int a, int b, Cost cost);
+
+    //Repairs the cached trees after fibre a-b was removed. Only a tree edge
+    //matters: the subtree below it loses its d, gets new d candidates from
+    //its neighbours outside the subtree and a Dijkstra inside it fixes the
+    //rest.
+    // Estimate of performance: W(t * (a log a + k_a)) where a = nodes in the
+    // cut subtree and k_a = their edges.
+    void repair_path_trees_removed(int a, int b);
+
+    //Drops every cached tree.
+    void clear_path_trees();
+
+    //Called whenever the fibres change. Bumps graph_version_ and marks the
+    //preprocessed route data dirty.
+    void fibres_changed();
+
+    //Copies the cached route for key to route if there is one for the
+    //current graph_version_, marks it most recently used and returns true.
+    //Updates the hit and miss counters. W/A/B(1) on average besides the copy.
+    bool cached_route(const Route_key& key, std::vector<std::pair<Coord, Cost>>& route) const;
+
+    //Stores route for key, evicting the least recently used route if the
+    //cache is full. W/A/B(1) on average.
+    void cache_route(const Route_key& key, const std::vector<std::pair<Coord, Cost>>& route) const;
+
+    //The uncached implementations of route_fastest and route_least_xpoints.
+    std::vector<std::pair<Coord, Cost>> search_fastest(Coord fromxpoint, Coord toxpoint) const;
+    std::vector<std::pair<Coord, Cost>> search_least_xpoints(Coord fromxpoint, Coord toxpoint) const;
+
+    //The part of search_fastest before the search itself. Returns true if
+    //the route is already known: an end is missing, the ends are in
+    //different components or a path tree of s has it. Otherwise s and t are
+    //set to the ids of the ends.
+    bool fastest_without_search(Coord fromxpoint, Coord toxpoint,
+                                std::vector<std::pair<Coord, Cost>>& fastest_route, int& s, int& t) const;
+
+    //True if route_fastest can use the contraction hierarchy: the engine is
+    //CH and no fibre cost is negative. Otherwise CH falls back to Dijkstra.
+    bool ch_usable() const;
+
+    //Brings the landmarks or the contraction hierarchy of the current route
+    //engine up to date. Must be called before fastest_between.
+    void prepare_route_engine() const;
+
+    //Fastest route from node s to node t with the current route engine,
+    //using S and Sb as the search states. Only reads the graph and the
+    //prepared engine data, so it can run in many threads with their own
+    //states.
+    std::vector<std::pair<Coord, Cost>> fastest_between(Search_state& S, Search_state& Sb, int s, int t) const;
+
+    //Route with the least xpoints using F and B as the search states. Only
+    //reads the graph, so it can run in many threads with their own states.
+    std::vector<std::pair<Coord, Cost>> least_xpoints_between(Search_state& F, Search_state& B,
+                                                              Coord fromxpoint, Coord toxpoint) const;
+
+    //Runs jobs 0 ... count-1 on the hardware threads. Every thread calls
+    //make_worker() once to get its worker, which owns the scratch state of
+    //the thread, and then worker(i) for the jobs it takes. Jobs are taken
+    //one at a time from a shared counter, so uneven jobs balance out.
+    template <typename Make_worker>
+    void parallel_for(std::size_t count, Make_worker make_worker) const;
+
+    //route_fastest_batch and route_least_xpoints_batch. Cached routes are
+    //looked up first, the rest are searched in parallel and cached after.
+    std::vector<std::vector<std::pair<Coord, Cost>>> route_batch(Route_kind kind,
+                                                                 std::span<const std::pair<Coord, Coord>> queries) const;
+
+    //Returns the route along node ids path with the cumulative fibre cost
+    //as the cost of every xpoint.
+    std::vector<std::pair<Coord, Cost>> route_with_costs(const std::vector<int>& path) const;
+
+    //Walks path_back of S from t to the root and returns the route root -> t
+    //with d of every node as its cost.
+    std::vector<std::pair<Coord, Cost>> build_route(const Search_state& S, int t) const;
 
     //std::shared_ptr<Fibre_node> dfs_recursive(std::shared_ptr<Fibre_node> s);
 };